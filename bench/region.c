@@ -0,0 +1,126 @@
+#define _POSIX_C_SOURCE 200809L
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pixman.h>
+#include <wlr/util/region.h>
+
+/* Region helpers microbenchmark.
+ *
+ * Measures wlr_region_scale(), wlr_region_transform() and
+ * wlr_region_expand() on damage shapes typically seen when rendering to
+ * fractionally scaled or rotated outputs.
+ *
+ * Usage: bench-region [-n iterations] */
+
+struct bench_shape {
+	const char *name;
+	void (*build)(pixman_region32_t *region);
+};
+
+static void build_single(pixman_region32_t *region) {
+	pixman_region32_union_rect(region, region, 100, 200, 640, 480);
+}
+
+/* A terminal: a few glyph cells and the cursor */
+static void build_terminal(pixman_region32_t *region) {
+	for (int i = 0; i < 6; i++) {
+		pixman_region32_union_rect(region, region, 20 + i * 90, 40 + i * 17,
+			9 * (i + 1), 17);
+	}
+	pixman_region32_union_rect(region, region, 600, 400, 2, 17);
+}
+
+/* A spreadsheet: scattered cells all over the output */
+static void build_spreadsheet(pixman_region32_t *region) {
+	for (int y = 0; y < 20; y++) {
+		for (int x = 0; x < 10; x++) {
+			if ((x * 7 + y * 3) % 4 == 0) {
+				pixman_region32_union_rect(region, region,
+					x * 190 + 4, y * 52 + 4, 120, 24);
+			}
+		}
+	}
+}
+
+static const struct bench_shape shapes[] = {
+	{ "single", build_single },
+	{ "terminal", build_terminal },
+	{ "spreadsheet", build_spreadsheet },
+};
+
+struct bench_op {
+	const char *name;
+	void (*run)(pixman_region32_t *dst, const pixman_region32_t *src);
+};
+
+static void run_scale(pixman_region32_t *dst, const pixman_region32_t *src) {
+	wlr_region_scale(dst, src, 1.5);
+}
+
+static void run_transform(pixman_region32_t *dst, const pixman_region32_t *src) {
+	wlr_region_transform(dst, src, WL_OUTPUT_TRANSFORM_90, 1920, 1080);
+}
+
+static void run_expand(pixman_region32_t *dst, const pixman_region32_t *src) {
+	wlr_region_expand(dst, src, 1);
+}
+
+static const struct bench_op ops[] = {
+	{ "scale", run_scale },
+	{ "transform", run_transform },
+	{ "expand", run_expand },
+};
+
+int main(int argc, char *argv[]) {
+	int iterations = 200000;
+	int c;
+	while ((c = getopt(argc, argv, "n:h")) != -1) {
+		switch (c) {
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n iterations]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (iterations <= 0) {
+		fprintf(stderr, "Invalid number of iterations\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%-12s %-10s %6s %10s\n", "shape", "op", "rects", "ns/op");
+
+	for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+		pixman_region32_t src;
+		pixman_region32_init(&src);
+		shapes[i].build(&src);
+
+		for (size_t j = 0; j < sizeof(ops) / sizeof(ops[0]); j++) {
+			pixman_region32_t dst;
+			pixman_region32_init(&dst);
+
+			struct timespec start, end;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (int k = 0; k < iterations; k++) {
+				ops[j].run(&dst, &src);
+			}
+			clock_gettime(CLOCK_MONOTONIC, &end);
+
+			int64_t duration = (end.tv_sec - start.tv_sec) * 1000000000LL +
+				(end.tv_nsec - start.tv_nsec);
+			printf("%-12s %-10s %6d %10.1f\n", shapes[i].name, ops[j].name,
+				pixman_region32_n_rects(&src), duration / (double)iterations);
+
+			pixman_region32_fini(&dst);
+		}
+
+		pixman_region32_fini(&src);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,752 @@
+#define _POSIX_C_SOURCE 200809L
+#include <drm_fourcc.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+#include <wlr/backend.h>
+#include <wlr/backend/headless.h>
+#include <wlr/interfaces/wlr_buffer.h>
+#include <wlr/render/allocator.h>
+#include <wlr/render/pixman.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/util/log.h>
+
+/* Scene-graph benchmark.
+ *
+ * Builds synthetic scenes against the headless backend and the pixman
+ * renderer, so that it can run on machines without a GPU, and reports the
+ * time spent in wlr_scene_output_build_state() along with the time spent
+ * updating the scene-graph, the damage complexity, heap allocations and
+ * memory usage for each scenario.
+ *
+ * Each scenario runs in its own process, so that the peak memory usage
+ * reported is the scenario's rather than the highest one seen so far.
+ *
+ * Usage: bench-scene [-n frames] [-c rect-cost] [-t threads] [scenario...]
+ *
+ * The -c option overrides the damage rectangle cost of the renderer, see
+ * wlr_damage_ring_set_rect_cost(). The -t option sets the number of worker
+ * threads compositing the render passes, see
+ * wlr_pixman_renderer_set_worker_threads(). */
+
+#define OUTPUT_WIDTH 1920
+#define OUTPUT_HEIGHT 1080
+#define WARMUP_FRAMES 16
+#define DAMAGE_TILE_SIZE 64
+
+/* Heap allocations are counted by interposing the allocator, region
+ * operations account for most of them in the damage paths. This relies on
+ * the glibc internal entry points, elsewhere the count is reported as -1. */
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static uint64_t alloc_count = 0;
+
+void *malloc(size_t size) {
+	__atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+	__atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	__atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+
+static int64_t get_alloc_count(void) {
+	return __atomic_load_n(&alloc_count, __ATOMIC_RELAXED);
+}
+#else
+static int64_t get_alloc_count(void) {
+	return -1;
+}
+#endif
+
+struct mem_buffer {
+	struct wlr_buffer base;
+	void *data;
+	size_t stride;
+	uint32_t format;
+	int fd; // -1 unless backed by shared memory
+};
+
+static void mem_buffer_destroy(struct wlr_buffer *wlr_buffer) {
+	struct mem_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	if (buffer->fd >= 0) {
+		munmap(buffer->data, buffer->stride * buffer->base.height);
+		close(buffer->fd);
+	} else {
+		free(buffer->data);
+	}
+	free(buffer);
+}
+
+static bool mem_buffer_get_shm(struct wlr_buffer *wlr_buffer,
+		struct wlr_shm_attributes *attribs) {
+	struct mem_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	if (buffer->fd < 0) {
+		return false;
+	}
+	*attribs = (struct wlr_shm_attributes){
+		.fd = buffer->fd,
+		.format = buffer->format,
+		.width = buffer->base.width,
+		.height = buffer->base.height,
+		.stride = buffer->stride,
+		.offset = 0,
+	};
+	return true;
+}
+
+static bool mem_buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
+		uint32_t flags, void **data, uint32_t *format, size_t *stride) {
+	struct mem_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	*data = buffer->data;
+	*format = buffer->format;
+	*stride = buffer->stride;
+	return true;
+}
+
+static void mem_buffer_end_data_ptr_access(struct wlr_buffer *wlr_buffer) {
+}
+
+static const struct wlr_buffer_impl mem_buffer_impl = {
+	.destroy = mem_buffer_destroy,
+	.get_shm = mem_buffer_get_shm,
+	.begin_data_ptr_access = mem_buffer_begin_data_ptr_access,
+	.end_data_ptr_access = mem_buffer_end_data_ptr_access,
+};
+
+static void *shm_map(size_t size, int *fd_ptr) {
+	static int counter = 0;
+	char name[64];
+	snprintf(name, sizeof(name), "/bench-scene-%d-%d", (int)getpid(), counter++);
+
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) {
+		return NULL;
+	}
+	shm_unlink(name);
+
+	void *data = MAP_FAILED;
+	if (ftruncate(fd, size) == 0) {
+		data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	if (data == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+
+	*fd_ptr = fd;
+	return data;
+}
+
+static struct wlr_buffer *mem_buffer_create(int width, int height,
+		uint32_t format, uint32_t color, bool shm) {
+	struct mem_buffer *buffer = calloc(1, sizeof(*buffer));
+	if (buffer == NULL) {
+		return NULL;
+	}
+
+	buffer->format = format;
+	buffer->stride = width * 4;
+	buffer->fd = -1;
+	if (shm) {
+		buffer->data = shm_map(buffer->stride * height, &buffer->fd);
+	} else {
+		buffer->data = malloc(buffer->stride * height);
+	}
+	if (buffer->data == NULL) {
+		free(buffer);
+		return NULL;
+	}
+
+	uint32_t *pixels = buffer->data;
+	for (int i = 0; i < width * height; i++) {
+		pixels[i] = color;
+	}
+
+	wlr_buffer_init(&buffer->base, &mem_buffer_impl, width, height);
+	return &buffer->base;
+}
+
+struct bench {
+	struct wl_display *display;
+	struct wlr_backend *backend;
+	struct wlr_renderer *renderer;
+	struct wlr_allocator *allocator;
+	struct wlr_output *output;
+
+	struct wlr_scene *scene;
+	struct wlr_scene_output *scene_output;
+
+	// Nodes of interest for the current scenario
+	struct wlr_scene_node **nodes;
+	size_t nodes_len;
+
+	uint32_t seed;
+};
+
+struct bench_scenario {
+	const char *name;
+	float scale;
+	void (*setup)(struct bench *bench);
+	void (*frame)(struct bench *bench, int frame);
+	// See wlr_scene_set_damage_tile_size()
+	int damage_tile_size;
+};
+
+static uint32_t bench_rand(struct bench *bench) {
+	// Deterministic LCG, so that runs are comparable
+	bench->seed = bench->seed * 1103515245 + 12345;
+	return bench->seed >> 8;
+}
+
+static struct wlr_scene_buffer *add_buffer(struct wlr_scene_tree *parent,
+		int width, int height, bool opaque) {
+	uint32_t format = opaque ? DRM_FORMAT_XRGB8888 : DRM_FORMAT_ARGB8888;
+	struct wlr_buffer *buffer = mem_buffer_create(width, height, format,
+		opaque ? 0xFF336699 : 0x80336699, false);
+	if (buffer == NULL) {
+		return NULL;
+	}
+
+	struct wlr_scene_buffer *scene_buffer = wlr_scene_buffer_create(parent, buffer);
+	wlr_buffer_drop(buffer);
+	return scene_buffer;
+}
+
+static void push_node(struct bench *bench, struct wlr_scene_node *node) {
+	struct wlr_scene_node **nodes = realloc(bench->nodes,
+		(bench->nodes_len + 1) * sizeof(*nodes));
+	if (nodes == NULL) {
+		return;
+	}
+	bench->nodes = nodes;
+	bench->nodes[bench->nodes_len++] = node;
+}
+
+static void damage_buffer(struct wlr_scene_buffer *scene_buffer,
+		int x, int y, int width, int height) {
+	pixman_region32_t damage;
+	pixman_region32_init_rect(&damage, x, y, width, height);
+	wlr_scene_buffer_set_buffer_with_damage(scene_buffer,
+		scene_buffer->buffer, &damage);
+	pixman_region32_fini(&damage);
+}
+
+/* A desktop with many overlapping decorated windows. Each frame, one
+ * window is moved around. */
+static void stacked_windows_setup(struct bench *bench) {
+	static const float border[4] = { 0.2, 0.2, 0.2, 1 };
+	for (int i = 0; i < 200; i++) {
+		struct wlr_scene_tree *tree = wlr_scene_tree_create(&bench->scene->tree);
+		wlr_scene_rect_create(tree, 644, 484, border);
+		struct wlr_scene_buffer *buffer = add_buffer(tree, 640, 480, i % 4 != 0);
+		wlr_scene_node_set_position(&buffer->node, 2, 2);
+		wlr_scene_node_set_position(&tree->node,
+			bench_rand(bench) % (OUTPUT_WIDTH - 600),
+			bench_rand(bench) % (OUTPUT_HEIGHT - 400));
+		push_node(bench, &tree->node);
+	}
+}
+
+static void stacked_windows_frame(struct bench *bench, int frame) {
+	struct wlr_scene_node *node = bench->nodes[frame % bench->nodes_len];
+	wlr_scene_node_set_position(node, node->x + (frame % 2 ? 7 : -5),
+		node->y + (frame % 3 ? 3 : -4));
+	if (frame % 16 == 0) {
+		wlr_scene_node_raise_to_top(node);
+	}
+}
+
+/* A few windows with deep sub-surface hierarchies. Each frame, a leaf
+ * sub-surface is updated. */
+static void deep_subsurfaces_setup(struct bench *bench) {
+	for (int i = 0; i < 8; i++) {
+		struct wlr_scene_tree *tree = wlr_scene_tree_create(&bench->scene->tree);
+		wlr_scene_node_set_position(&tree->node, 100 + i * 200, 100);
+		add_buffer(tree, 400, 600, true);
+
+		for (int depth = 0; depth < 64; depth++) {
+			tree = wlr_scene_tree_create(tree);
+			wlr_scene_node_set_position(&tree->node, 1, 4);
+			struct wlr_scene_buffer *buffer = add_buffer(tree, 64, 32, false);
+			if (depth == 63) {
+				push_node(bench, &buffer->node);
+			}
+		}
+	}
+}
+
+static void deep_subsurfaces_frame(struct bench *bench, int frame) {
+	struct wlr_scene_node *node = bench->nodes[frame % bench->nodes_len];
+	damage_buffer(wlr_scene_buffer_from_node(node), 0, 0, 64, 32);
+}
+
+/* Many windows with small, scattered updates every frame, like terminals
+ * and clocks. */
+static void small_damage_setup(struct bench *bench) {
+	for (int y = 0; y < 4; y++) {
+		for (int x = 0; x < 6; x++) {
+			struct wlr_scene_buffer *buffer =
+				add_buffer(&bench->scene->tree, 320, 270, true);
+			wlr_scene_node_set_position(&buffer->node, x * 320, y * 270);
+			push_node(bench, &buffer->node);
+		}
+	}
+}
+
+static void small_damage_frame(struct bench *bench, int frame) {
+	for (int i = 0; i < 8; i++) {
+		struct wlr_scene_node *node =
+			bench->nodes[bench_rand(bench) % bench->nodes_len];
+		damage_buffer(wlr_scene_buffer_from_node(node),
+			bench_rand(bench) % 300, bench_rand(bench) % 250, 8, 16);
+	}
+}
+
+/* Menus and tooltips being created and destroyed every frame on top of a
+ * few windows. */
+static void popup_churn_setup(struct bench *bench) {
+	for (int i = 0; i < 16; i++) {
+		struct wlr_scene_buffer *buffer =
+			add_buffer(&bench->scene->tree, 800, 600, true);
+		wlr_scene_node_set_position(&buffer->node,
+			bench_rand(bench) % (OUTPUT_WIDTH - 800),
+			bench_rand(bench) % (OUTPUT_HEIGHT - 600));
+	}
+}
+
+static void popup_churn_frame(struct bench *bench, int frame) {
+	if (bench->nodes_len >= 8) {
+		wlr_scene_node_destroy(bench->nodes[0]);
+		memmove(&bench->nodes[0], &bench->nodes[1],
+			(bench->nodes_len - 1) * sizeof(bench->nodes[0]));
+		bench->nodes_len--;
+	}
+
+	struct wlr_scene_tree *popup = wlr_scene_tree_create(&bench->scene->tree);
+	wlr_scene_node_set_position(&popup->node,
+		bench_rand(bench) % (OUTPUT_WIDTH - 200),
+		bench_rand(bench) % (OUTPUT_HEIGHT - 300));
+	add_buffer(popup, 200, 300, false);
+	for (int i = 0; i < 10; i++) {
+		struct wlr_scene_buffer *item = add_buffer(popup, 196, 24, true);
+		wlr_scene_node_set_position(&item->node, 2, 2 + i * 28);
+	}
+	push_node(bench, &popup->node);
+}
+
+/* A full-screen window with many small updates in a few distant spots,
+ * like a clock in a corner and a cursor trail in the opposite one. */
+static void fragmented_damage_setup(struct bench *bench) {
+	struct wlr_scene_buffer *buffer =
+		add_buffer(&bench->scene->tree, OUTPUT_WIDTH, OUTPUT_HEIGHT, true);
+	push_node(bench, &buffer->node);
+}
+
+static void fragmented_damage_frame(struct bench *bench, int frame) {
+	struct wlr_scene_buffer *buffer = wlr_scene_buffer_from_node(bench->nodes[0]);
+
+	pixman_region32_t damage;
+	pixman_region32_init(&damage);
+
+	// Clock digits
+	for (int i = 0; i < 6; i++) {
+		pixman_region32_union_rect(&damage, &damage,
+			OUTPUT_WIDTH - 160 + i * 24, 8, 16, 24);
+	}
+
+	// Cursor trail
+	for (int i = 0; i < 12; i++) {
+		int t = frame * 4 + i;
+		pixman_region32_union_rect(&damage, &damage,
+			40 + (t * 7) % 200, OUTPUT_HEIGHT - 240 + (t * 13) % 200, 24, 24);
+	}
+
+	// Scattered blinking cursors and spinners
+	for (int i = 0; i < 8; i++) {
+		pixman_region32_union_rect(&damage, &damage,
+			bench_rand(bench) % (OUTPUT_WIDTH - 16),
+			bench_rand(bench) % (OUTPUT_HEIGHT - 16), 8, 16);
+	}
+
+	wlr_scene_buffer_set_buffer_with_damage(buffer, buffer->buffer, &damage);
+	pixman_region32_fini(&damage);
+}
+
+/* A spreadsheet recomputing hundreds of scattered cells every frame. The
+ * damage history of the output is as fragmented as it gets. */
+#define SPREADSHEET_CELL_WIDTH 96
+#define SPREADSHEET_CELL_HEIGHT 24
+
+static void spreadsheet_damage_frame(struct bench *bench, int frame) {
+	struct wlr_scene_buffer *buffer = wlr_scene_buffer_from_node(bench->nodes[0]);
+	int cols = OUTPUT_WIDTH / SPREADSHEET_CELL_WIDTH;
+	int rows = OUTPUT_HEIGHT / SPREADSHEET_CELL_HEIGHT;
+
+	pixman_region32_t damage;
+	pixman_region32_init(&damage);
+	for (int i = 0; i < 300; i++) {
+		int col = bench_rand(bench) % cols;
+		int row = bench_rand(bench) % rows;
+		// Only the text of the cell changes, not its borders
+		pixman_region32_union_rect(&damage, &damage,
+			col * SPREADSHEET_CELL_WIDTH + 4, row * SPREADSHEET_CELL_HEIGHT + 4,
+			SPREADSHEET_CELL_WIDTH - 8, SPREADSHEET_CELL_HEIGHT - 8);
+	}
+
+	wlr_scene_buffer_set_buffer_with_damage(buffer, buffer->buffer, &damage);
+	pixman_region32_fini(&damage);
+}
+
+/* Deep nested trees, like toolkits mapping every widget to a sub-surface,
+ * with whole branches being torn down and rebuilt every frame. */
+static struct wlr_scene_tree *add_branch(struct wlr_scene_tree *parent,
+		int depth) {
+	static const float color[4] = { 0.4, 0.4, 0.4, 1 };
+	struct wlr_scene_tree *root = wlr_scene_tree_create(parent);
+	struct wlr_scene_tree *tree = root;
+	for (int i = 0; i < depth; i++) {
+		tree = wlr_scene_tree_create(tree);
+		wlr_scene_node_set_position(&tree->node, 2, 3);
+		wlr_scene_rect_create(tree, 120, 4, color);
+		add_buffer(tree, 16, 16, false);
+	}
+	return root;
+}
+
+static void deep_tree_setup(struct bench *bench) {
+	for (int i = 0; i < 16; i++) {
+		struct wlr_scene_tree *branch = add_branch(&bench->scene->tree, 128);
+		wlr_scene_node_set_position(&branch->node,
+			(i % 8) * 240, (i / 8) * 540);
+		push_node(bench, &branch->node);
+	}
+}
+
+static void deep_tree_frame(struct bench *bench, int frame) {
+	size_t i = frame % bench->nodes_len;
+	struct wlr_scene_node *node = bench->nodes[i];
+	int x = node->x, y = node->y;
+	wlr_scene_node_destroy(node);
+
+	struct wlr_scene_tree *branch = add_branch(&bench->scene->tree, 128);
+	wlr_scene_node_set_position(&branch->node, x, y);
+	bench->nodes[i] = &branch->node;
+}
+
+/* Many views of a single shared memory buffer, like a client showing the
+ * same surface on several places. Each frame, the buffer is damaged, so
+ * that the renderer creates a texture per view from the same buffer. */
+static void shared_shm_buffer_setup(struct bench *bench) {
+	struct wlr_buffer *buffer = mem_buffer_create(256, 256,
+		DRM_FORMAT_ARGB8888, 0x80336699, true);
+	if (buffer == NULL) {
+		return;
+	}
+
+	for (int i = 0; i < 24; i++) {
+		struct wlr_scene_buffer *scene_buffer =
+			wlr_scene_buffer_create(&bench->scene->tree, buffer);
+		wlr_scene_node_set_position(&scene_buffer->node,
+			(i % 6) * 300, (i / 6) * 260);
+		push_node(bench, &scene_buffer->node);
+	}
+	wlr_buffer_drop(buffer);
+}
+
+static void shared_shm_buffer_frame(struct bench *bench, int frame) {
+	for (size_t i = 0; i < bench->nodes_len; i++) {
+		damage_buffer(wlr_scene_buffer_from_node(bench->nodes[i]),
+			frame % 240, 0, 16, 256);
+	}
+}
+
+static const struct bench_scenario scenarios[] = {
+	{ "stacked-windows", 1, stacked_windows_setup, stacked_windows_frame },
+	{ "deep-subsurfaces", 1, deep_subsurfaces_setup, deep_subsurfaces_frame },
+	{ "small-damage", 1, small_damage_setup, small_damage_frame },
+	{ "popup-churn", 1, popup_churn_setup, popup_churn_frame },
+	{ "deep-tree", 1, deep_tree_setup, deep_tree_frame },
+	{ "fragmented-damage", 1, fragmented_damage_setup, fragmented_damage_frame },
+	{ "fractional-scale", 1.5, stacked_windows_setup, stacked_windows_frame },
+	{ "fractional-small-damage", 1.5, small_damage_setup, small_damage_frame },
+	{ "shared-shm-buffer", 1, shared_shm_buffer_setup, shared_shm_buffer_frame },
+	{ "spreadsheet-damage", 1, fragmented_damage_setup, spreadsheet_damage_frame },
+	// Same as above, with the damage history of the output kept in tiles
+	{ "small-damage-tiles", 1, small_damage_setup, small_damage_frame,
+		DAMAGE_TILE_SIZE },
+	{ "fragmented-damage-tiles", 1, fragmented_damage_setup,
+		fragmented_damage_frame, DAMAGE_TILE_SIZE },
+	{ "spreadsheet-damage-tiles", 1, fragmented_damage_setup,
+		spreadsheet_damage_frame, DAMAGE_TILE_SIZE },
+};
+
+static int compare_int64(const void *a, const void *b) {
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static bool bench_frame(struct bench *bench, int64_t *duration,
+		struct wlr_scene_output_stats *stats) {
+	struct wlr_scene_output_state_options options = {
+		.stats = stats,
+	};
+
+	struct wlr_output_state state;
+	wlr_output_state_init(&state);
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	bool ok = wlr_scene_output_build_state(bench->scene_output, &state, &options);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	*duration = (end.tv_sec - start.tv_sec) * 1000000000LL +
+		(end.tv_nsec - start.tv_nsec);
+
+	if (ok && wlr_output_commit_state(bench->output, &state)) {
+		wlr_damage_ring_rotate(&bench->scene_output->damage_ring);
+	}
+	wlr_output_state_finish(&state);
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	wlr_scene_output_send_frame_done(bench->scene_output, &now);
+	wl_event_loop_dispatch(wl_display_get_event_loop(bench->display), 0);
+
+	return ok;
+}
+
+static bool run_scenario(struct bench *bench,
+		const struct bench_scenario *scenario, int frames) {
+	struct wlr_output_state state;
+	wlr_output_state_init(&state);
+	wlr_output_state_set_scale(&state, scenario->scale);
+	bool ok = wlr_output_commit_state(bench->output, &state);
+	wlr_output_state_finish(&state);
+	if (!ok) {
+		fprintf(stderr, "Failed to set output scale\n");
+		return false;
+	}
+
+	bench->scene = wlr_scene_create();
+	bench->scene_output = wlr_scene_output_create(bench->scene, bench->output);
+	bench->nodes = NULL;
+	bench->nodes_len = 0;
+	bench->seed = 42;
+	if (bench->scene == NULL || bench->scene_output == NULL) {
+		return false;
+	}
+	wlr_scene_set_damage_tile_size(bench->scene, scenario->damage_tile_size);
+
+	scenario->setup(bench);
+
+	int64_t *durations = calloc(frames, sizeof(*durations));
+	if (durations == NULL) {
+		return false;
+	}
+
+	uint64_t total_list_len = 0, total_rects = 0, total_area = 0;
+	int64_t total_update = 0, total_allocs = 0;
+	for (int i = -WARMUP_FRAMES; i < frames; i++) {
+		int64_t allocs = get_alloc_count();
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		scenario->frame(bench, i + WARMUP_FRAMES);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		int64_t duration;
+		struct wlr_scene_output_stats stats;
+		if (!bench_frame(bench, &duration, &stats)) {
+			fprintf(stderr, "Failed to render frame\n");
+			free(durations);
+			return false;
+		}
+		allocs = allocs >= 0 ? get_alloc_count() - allocs : -1;
+
+		if (i >= 0) {
+			total_allocs += allocs;
+			durations[i] = duration;
+			total_update += (end.tv_sec - start.tv_sec) * 1000000000LL +
+				(end.tv_nsec - start.tv_nsec);
+			total_list_len += stats.render_list_len;
+			total_rects += stats.damage_rects;
+			total_area += stats.damage_area;
+		}
+	}
+
+	int64_t total = 0;
+	for (int i = 0; i < frames; i++) {
+		total += durations[i];
+	}
+	qsort(durations, frames, sizeof(*durations), compare_int64);
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	printf("%-24s %8.1f %8.1f %8.1f %8.1f %9.1f %8.1f %8.1f %10.0f %8.1f %10ld\n",
+		scenario->name,
+		total / (double)frames / 1000,
+		durations[frames / 2] / 1000.0,
+		durations[frames * 99 / 100] / 1000.0,
+		durations[frames - 1] / 1000.0,
+		total_update / (double)frames / 1000,
+		total_list_len / (double)frames,
+		total_rects / (double)frames,
+		total_area / (double)frames,
+		total_allocs / (double)frames,
+		usage.ru_maxrss);
+
+	free(durations);
+	wlr_scene_node_destroy(&bench->scene->tree.node);
+	free(bench->nodes);
+	return true;
+}
+
+static bool bench_init(struct bench *bench, int rect_cost, int threads) {
+	bench->display = wl_display_create();
+	bench->backend = wlr_headless_backend_create(bench->display);
+	bench->renderer = wlr_pixman_renderer_create();
+	if (bench->backend == NULL || bench->renderer == NULL) {
+		fprintf(stderr, "Failed to create headless backend or pixman renderer\n");
+		return false;
+	}
+	if (rect_cost >= 0) {
+		bench->renderer->damage_rect_cost = rect_cost;
+	}
+	if (!wlr_pixman_renderer_set_worker_threads(bench->renderer, threads)) {
+		fprintf(stderr, "Failed to create worker threads\n");
+		return false;
+	}
+	bench->allocator = wlr_allocator_autocreate(bench->backend, bench->renderer);
+	if (bench->allocator == NULL || !wlr_backend_start(bench->backend)) {
+		fprintf(stderr, "Failed to start headless backend\n");
+		return false;
+	}
+
+	bench->output = wlr_headless_add_output(bench->backend,
+		OUTPUT_WIDTH, OUTPUT_HEIGHT);
+	wlr_output_init_render(bench->output, bench->allocator, bench->renderer);
+
+	struct wlr_output_state state;
+	wlr_output_state_init(&state);
+	wlr_output_state_set_enabled(&state, true);
+	bool ok = wlr_output_commit_state(bench->output, &state);
+	wlr_output_state_finish(&state);
+	if (!ok) {
+		fprintf(stderr, "Failed to enable output\n");
+		return false;
+	}
+	return true;
+}
+
+static void bench_finish(struct bench *bench) {
+	wlr_allocator_destroy(bench->allocator);
+	wlr_renderer_destroy(bench->renderer);
+	wlr_backend_destroy(bench->backend);
+	if (bench->display != NULL) {
+		wl_display_destroy(bench->display);
+	}
+}
+
+/* Runs a scenario in a child process. Worker threads don't survive fork(),
+ * so the child sets up the backend and renderer itself. */
+static bool run_scenario_process(const struct bench_scenario *scenario,
+		int frames, int rect_cost, int threads) {
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return false;
+	} else if (pid == 0) {
+		struct bench bench = {0};
+		bool ok = bench_init(&bench, rect_cost, threads) &&
+			run_scenario(&bench, scenario, frames);
+		bench_finish(&bench);
+		fflush(stdout);
+		_exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	int status;
+	if (waitpid(pid, &status, 0) < 0) {
+		perror("waitpid");
+		return false;
+	}
+	if (!WIFEXITED(status)) {
+		fprintf(stderr, "Scenario %s crashed\n", scenario->name);
+		return false;
+	}
+	return WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+	wlr_log_init(WLR_ERROR, NULL);
+
+	int frames = 500;
+	int rect_cost = -1;
+	int threads = 0;
+	int c;
+	while ((c = getopt(argc, argv, "n:c:t:h")) != -1) {
+		switch (c) {
+		case 'n':
+			frames = atoi(optarg);
+			break;
+		case 'c':
+			rect_cost = atoi(optarg);
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n frames] [-c rect-cost] [-t threads] "
+				"[scenario...]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (frames <= 0) {
+		fprintf(stderr, "Invalid number of frames\n");
+		return EXIT_FAILURE;
+	}
+	if (threads < 0) {
+		fprintf(stderr, "Invalid number of threads\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%-24s %8s %8s %8s %8s %9s %8s %8s %10s %8s %10s\n", "scenario",
+		"mean-us", "p50-us", "p99-us", "max-us", "update-us", "entries",
+		"rects", "area", "allocs", "maxrss-kb");
+
+	int ret = EXIT_SUCCESS;
+	size_t scenarios_len = sizeof(scenarios) / sizeof(scenarios[0]);
+	for (size_t i = 0; i < scenarios_len; i++) {
+		bool selected = optind == argc;
+		for (int j = optind; j < argc; j++) {
+			selected = selected || strcmp(argv[j], scenarios[i].name) == 0;
+		}
+
+		if (selected && !run_scenario_process(&scenarios[i], frames,
+				rect_cost, threads)) {
+			ret = EXIT_FAILURE;
+		}
+	}
+
+	return ret;
+}
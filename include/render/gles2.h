@@ -13,6 +13,7 @@
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/render/wlr_texture.h>
 #include <wlr/util/addon.h>
+#include <wlr/util/box.h>
 #include <wlr/util/log.h>
 
 // mesa ships old GL headers that don't include this type, so for distros that use headers from
@@ -28,13 +29,13 @@ struct wlr_gles2_pixel_format {
 	bool has_alpha;
 };
 
-struct wlr_gles2_tex_shader {
+struct wlr_gles2_shader {
 	GLuint program;
 	GLint proj;
-	GLint tex_proj;
-	GLint tex;
-	GLint alpha;
+	GLint tex; // -1 if the shader doesn't sample a texture
 	GLint pos_attrib;
+	GLint texcoord_attrib;
+	GLint color_attrib;
 };
 
 struct wlr_gles2_renderer {
@@ -54,6 +55,10 @@ struct wlr_gles2_renderer {
 		bool OES_texture_half_float_linear;
 		bool EXT_texture_norm16;
 		bool EXT_disjoint_timer_query;
+		bool OES_get_program_binary;
+		// GL_NV_pixel_buffer_object, GL_EXT_map_buffer_range and
+		// GL_OES_mapbuffer
+		bool pbo;
 	} exts;
 
 	struct {
@@ -70,22 +75,39 @@ struct wlr_gles2_renderer {
 		PFNGLGETQUERYOBJECTIVEXTPROC glGetQueryObjectivEXT;
 		PFNGLGETQUERYOBJECTUI64VEXTPROC glGetQueryObjectui64vEXT;
 		PFNGLGETINTEGER64VEXTPROC glGetInteger64vEXT;
+		PFNGLMAPBUFFERRANGEEXTPROC glMapBufferRangeEXT;
+		PFNGLUNMAPBUFFEROESPROC glUnmapBufferOES;
+		PFNGLGETPROGRAMBINARYOESPROC glGetProgramBinaryOES;
+		PFNGLPROGRAMBINARYOESPROC glProgramBinaryOES;
 	} procs;
 
 	struct {
-		struct {
-			GLuint program;
-			GLint proj;
-			GLint color;
-			GLint pos_attrib;
-		} quad;
-		struct wlr_gles2_tex_shader tex_rgba;
-		struct wlr_gles2_tex_shader tex_rgbx;
-		struct wlr_gles2_tex_shader tex_ext;
+		char *dir; // NULL if the cache is disabled
+		uint64_t driver_key; // hash of the driver strings
+		size_t loaded; // number of programs loaded from the cache
+	} program_cache;
+
+	struct {
+		struct wlr_gles2_shader quad;
+		struct wlr_gles2_shader tex_rgba;
+		struct wlr_gles2_shader tex_rgbx;
+		struct wlr_gles2_shader tex_ext;
 	} shaders;
 
+	// Vertex buffer shared by all render passes, used as a ring: passes
+	// append their vertices and the buffer is orphaned when it wraps around
+	GLuint vbo;
+	size_t vbo_size, vbo_offset;
+
+	// Pixel buffer object used for texture uploads, managed like the vertex
+	// buffer. Only used if exts.pbo is set.
+	GLuint pbo;
+	size_t pbo_size, pbo_offset;
+
 	struct wl_list buffers; // wlr_gles2_buffer.link
 	struct wl_list textures; // wlr_gles2_texture.link
+	struct wl_list atlas_pages; // wlr_gles2_atlas_page.link
+	bool atlas_enabled;
 
 	struct wlr_gles2_buffer *current_buffer;
 	uint32_t viewport_width, viewport_height;
@@ -132,6 +154,54 @@ struct wlr_gles2_texture {
 	// If imported from a wlr_buffer
 	struct wlr_buffer *buffer;
 	struct wlr_addon buffer_addon;
+
+	// If the texture is packed into an atlas page, tex is the page texture
+	// and atlas_box is the area of the page holding the texture
+	struct wlr_gles2_atlas_page *atlas;
+	struct wlr_box atlas_box;
+};
+
+struct wlr_gles2_atlas_shelf {
+	int y, height;
+	int x; // start of the free space
+	size_t textures_len;
+};
+
+#define GLES2_ATLAS_PAGE_SIZE 1024
+
+/**
+ * A texture shared by small textures of the same format, so that they can
+ * be drawn together. Space is allocated in horizontal shelves.
+ */
+struct wlr_gles2_atlas_page {
+	struct wlr_gles2_renderer *renderer;
+	struct wl_list link; // wlr_gles2_renderer.atlas_pages
+
+	GLuint tex;
+	uint32_t drm_format;
+
+	struct wl_array shelves; // struct wlr_gles2_atlas_shelf, sorted by y
+	size_t textures_len;
+};
+
+struct wlr_gles2_vertex {
+	GLfloat pos[2]; // buffer-local coordinates
+	GLfloat texcoord[2];
+	GLfloat color[4]; // the alpha component is the opacity of textures
+};
+
+/**
+ * A draw call recorded by a render pass. Operations sharing the same GL state
+ * are merged into a single draw.
+ */
+struct wlr_gles2_draw {
+	const struct wlr_gles2_shader *shader;
+	GLenum target; // 0 for untextured draws
+	GLuint tex;
+	GLint filter;
+	bool blend;
+
+	size_t first, count; // in vertices
 };
 
 struct wlr_gles2_render_pass {
@@ -139,6 +209,10 @@ struct wlr_gles2_render_pass {
 	struct wlr_gles2_buffer *buffer;
 	float projection_matrix[9];
 	struct wlr_gles2_render_timer *timer;
+
+	// Recorded operations, executed on submit
+	struct wl_array vertices; // struct wlr_gles2_vertex
+	struct wl_array draws; // struct wlr_gles2_draw
 };
 
 bool is_gles2_pixel_format_supported(const struct wlr_gles2_renderer *renderer,
@@ -162,6 +236,48 @@ struct wlr_gles2_texture *gles2_texture_create(
 	struct wlr_gles2_renderer *renderer, uint32_t width, uint32_t height);
 void gles2_texture_destroy(struct wlr_gles2_texture *texture);
 
+/**
+ * Convert a box in texture coordinates to normalized coordinates of the GL
+ * texture, which is an atlas page for packed textures.
+ */
+void gles2_texture_normalize_box(const struct wlr_gles2_texture *texture,
+	struct wlr_fbox *box);
+
+/**
+ * Allocate space for the texture in an atlas page, the texture needs to be
+ * small enough. On success, the texture's tex, atlas and atlas_box are set.
+ */
+bool gles2_atlas_add_texture(struct wlr_gles2_renderer *renderer,
+	struct wlr_gles2_texture *texture, const struct wlr_gles2_pixel_format *fmt);
+/**
+ * Give the space used by the texture back to its page. Empty pages are
+ * destroyed.
+ */
+void gles2_atlas_remove_texture(struct wlr_gles2_texture *texture);
+/**
+ * Upload data to a packed texture. The edges are replicated into the padding
+ * around the texture, so that filtering doesn't sample neighbours.
+ */
+void gles2_atlas_upload(struct wlr_gles2_texture *texture,
+	const struct wlr_gles2_pixel_format *fmt, uint32_t bytes_per_pixel,
+	const pixman_region32_t *region, const void *data, size_t stride);
+void gles2_atlas_finish(struct wlr_gles2_renderer *renderer);
+
+/**
+ * Set up the program binary cache, the renderer's context must be current.
+ * Does nothing if the driver doesn't support program binaries.
+ */
+void gles2_program_cache_init(struct wlr_gles2_renderer *renderer);
+void gles2_program_cache_finish(struct wlr_gles2_renderer *renderer);
+/**
+ * Load a linked program from the cache. Returns 0 on failure, in which case
+ * the program needs to be compiled.
+ */
+GLuint gles2_program_cache_load(struct wlr_gles2_renderer *renderer,
+	const GLchar *vert_src, const GLchar *frag_src);
+void gles2_program_cache_store(struct wlr_gles2_renderer *renderer,
+	GLuint prog, const GLchar *vert_src, const GLchar *frag_src);
+
 void push_gles2_debug_(struct wlr_gles2_renderer *renderer,
 	const char *file, const char *func);
 #define push_gles2_debug(renderer) push_gles2_debug_(renderer, _WLR_FILENAME, __func__)
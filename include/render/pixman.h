@@ -12,7 +12,15 @@ struct wlr_pixman_pixel_format {
 	pixman_format_code_t pixman_format;
 };
 
+#define WLR_PIXMAN_MASK_CACHE_SIZE 32
+
 struct wlr_pixman_buffer;
+struct worker_pool;
+
+struct wlr_pixman_solid_mask {
+	uint16_t alpha;
+	pixman_image_t *image; // may be NULL
+};
 
 struct wlr_pixman_renderer {
 	struct wlr_renderer wlr_renderer;
@@ -24,6 +32,12 @@ struct wlr_pixman_renderer {
 	int32_t width, height;
 
 	struct wlr_drm_format_set drm_formats;
+
+	struct worker_pool *worker_pool; // may be NULL
+	size_t worker_threads;
+
+	// Solid fill masks used for texture alpha, indexed by alpha value
+	struct wlr_pixman_solid_mask masks[WLR_PIXMAN_MASK_CACHE_SIZE];
 };
 
 struct wlr_pixman_buffer {
@@ -49,9 +63,18 @@ struct wlr_pixman_texture {
 	struct wlr_buffer *buffer; // if created via texture_from_buffer
 };
 
+// A texture buffer with data ptr access for the duration of a render pass
+struct wlr_pixman_pass_buffer {
+	struct wlr_buffer *buffer; // locked
+	pixman_image_t *image; // wraps the data ptr of the access
+};
+
 struct wlr_pixman_render_pass {
 	struct wlr_render_pass base;
 	struct wlr_pixman_buffer *buffer;
+
+	struct wl_array ops; // struct wlr_pixman_render_op
+	struct wl_array buffers; // struct wlr_pixman_pass_buffer
 };
 
 pixman_format_code_t get_pixman_format_from_drm(uint32_t fmt);
@@ -61,6 +84,13 @@ const uint32_t *get_pixman_drm_formats(size_t *len);
 bool begin_pixman_data_ptr_access(struct wlr_buffer *buffer, pixman_image_t **image_ptr,
 	uint32_t flags);
 
+/**
+ * Get a solid fill image with the given alpha, to be used as a mask. The
+ * caller receives a new reference.
+ */
+pixman_image_t *pixman_renderer_get_solid_mask(
+	struct wlr_pixman_renderer *renderer, float alpha);
+
 struct wlr_pixman_render_pass *begin_pixman_render_pass(
 	struct wlr_pixman_buffer *buffer);
 
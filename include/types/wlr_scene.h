@@ -3,6 +3,18 @@
 
 #include <wlr/types/wlr_scene.h>
 
+/**
+ * Contents of a cached tree, rendered for outputs with a given renderer and
+ * scale.
+ */
+struct wlr_scene_tree_cache {
+	struct wlr_renderer *renderer;
+	float scale;
+	struct wlr_buffer *buffer; // may be NULL
+	struct wlr_texture *texture; // may be NULL
+	uint64_t generation; // wlr_scene_tree.cache_generation when rendered
+};
+
 struct wlr_scene *scene_node_get_root(struct wlr_scene_node *node);
 
 void scene_surface_set_clip(struct wlr_scene_surface *surface, struct wlr_box *clip);
@@ -0,0 +1,73 @@
+#ifndef UTIL_TILE_BITMAP_H
+#define UTIL_TILE_BITMAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pixman.h>
+
+/**
+ * `struct tile_bitmap` tracks damage at the granularity of square tiles, with
+ * one bit per tile. Unlike pixman regions, the cost of adding damage and of
+ * combining two bitmaps doesn't depend on how fragmented the damage is, at the
+ * price of rounding damage up to whole tiles.
+ *
+ * Rows are stored as 64-bit words, so that combining bitmaps and testing boxes
+ * are plain word-wise OR and AND loops, simple enough for compilers to
+ * vectorize.
+ *
+ * Two bitmaps can only be combined if they have the same dimensions.
+ */
+struct tile_bitmap {
+	int width, height; // in pixels
+	int tile_size;
+	int cols, rows;
+	size_t stride; // number of words per row
+	uint64_t *bits;
+};
+
+/**
+ * Initialize an empty bitmap covering width x height pixels.
+ *
+ * Returns false on allocation failure.
+ */
+bool tile_bitmap_init(struct tile_bitmap *tb, int width, int height,
+	int tile_size);
+
+void tile_bitmap_finish(struct tile_bitmap *tb);
+
+void tile_bitmap_clear(struct tile_bitmap *tb);
+
+/**
+ * Mark all tiles as damaged.
+ */
+void tile_bitmap_fill(struct tile_bitmap *tb);
+
+/**
+ * Mark all tiles intersecting the box as damaged. The box is clipped to the
+ * bitmap bounds.
+ */
+void tile_bitmap_add_box(struct tile_bitmap *tb, const pixman_box32_t *box);
+
+void tile_bitmap_add_region(struct tile_bitmap *tb,
+	const pixman_region32_t *region);
+
+/**
+ * Add the damage of src to dst.
+ */
+void tile_bitmap_or(struct tile_bitmap *dst, const struct tile_bitmap *src);
+
+/**
+ * Check whether any tile intersecting the box is damaged. The box is clipped
+ * to the bitmap bounds.
+ */
+bool tile_bitmap_intersects_box(const struct tile_bitmap *tb,
+	const pixman_box32_t *box);
+
+/**
+ * Add the damaged tiles to a region, merging adjacent tiles into rectangles.
+ */
+void tile_bitmap_union_region(const struct tile_bitmap *tb,
+	pixman_region32_t *region);
+
+#endif
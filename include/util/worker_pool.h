@@ -0,0 +1,34 @@
+#ifndef UTIL_WORKER_POOL_H
+#define UTIL_WORKER_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct worker_pool;
+
+typedef void (*worker_pool_func_t)(void *data, size_t index);
+
+/**
+ * Create a pool of worker threads.
+ *
+ * Worker threads are created with all signals blocked except those raised by
+ * faults, so that other signals are always delivered to the main thread.
+ */
+struct worker_pool *worker_pool_create(size_t threads);
+
+/**
+ * Stop all worker threads and destroy the pool.
+ */
+void worker_pool_destroy(struct worker_pool *pool);
+
+/**
+ * Call func(data, i) for each i in [0, len), and wait for all calls to
+ * complete. The calls are spread among the worker threads and the calling
+ * thread.
+ *
+ * If pool is NULL, the calls are performed sequentially by the calling thread.
+ */
+void worker_pool_run(struct worker_pool *pool, size_t len,
+	worker_pool_func_t func, void *data);
+
+#endif
@@ -11,6 +11,7 @@
 
 #include <GLES2/gl2.h>
 #include <wlr/render/wlr_renderer.h>
+#include <wlr/util/box.h>
 
 struct wlr_egl;
 
@@ -30,6 +31,12 @@ struct wlr_gles2_texture_attribs {
 	GLuint tex;
 
 	bool has_alpha;
+
+	/* Area of tex holding the texture, in texels. When WLR_GLES2_ATLAS is
+	 * set, small textures are packed together into a larger GL texture,
+	 * and only this area of tex belongs to the texture. Otherwise, it
+	 * covers the whole of tex. */
+	struct wlr_box box;
 };
 
 bool wlr_renderer_is_gles2(struct wlr_renderer *wlr_renderer);
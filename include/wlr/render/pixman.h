@@ -19,6 +19,19 @@ struct wlr_renderer *wlr_pixman_renderer_create(void);
 pixman_image_t *wlr_pixman_renderer_get_current_image(
 	struct wlr_renderer *wlr_renderer);
 
+/**
+ * Set the number of worker threads used to composite render passes.
+ *
+ * Render pass operations are recorded, and composited when the pass is
+ * submitted. With worker threads, the render buffer is split into horizontal
+ * tiles which are composited in parallel.
+ *
+ * Zero disables worker threads, which is the default. Returns false if the
+ * threads couldn't be created.
+ */
+bool wlr_pixman_renderer_set_worker_threads(struct wlr_renderer *wlr_renderer,
+	size_t threads);
+
 bool wlr_renderer_is_pixman(struct wlr_renderer *wlr_renderer);
 bool wlr_texture_is_pixman(struct wlr_texture *texture);
 pixman_image_t *wlr_pixman_texture_get_image(struct wlr_texture *wlr_texture);
@@ -44,6 +44,10 @@ struct wlr_renderer {
 
 	bool rendering;
 	bool rendering_with_buffer;
+
+	// Overhead of drawing one more damage rectangle, expressed as a number
+	// of pixels, see wlr_damage_ring_set_rect_cost()
+	uint32_t damage_rect_cost;
 };
 
 /**
@@ -14,10 +14,16 @@
 #include <stdint.h>
 #include <pixman.h>
 
-/* For triple buffering, a history of two frames is required. */
+/* For triple buffering, a history of two frames is required. This is the
+ * default history length, see wlr_damage_ring_set_previous_len(). */
 #define WLR_DAMAGE_RING_PREVIOUS_LEN 2
 
+/* Default cost of a damage rectangle, tuned for GPU renderers where each
+ * rectangle is a separate scissored draw. */
+#define WLR_DAMAGE_RING_DEFAULT_RECT_COST (128 * 128)
+
 struct wlr_box;
+struct tile_bitmap;
 
 struct wlr_damage_ring {
 	int32_t width, height;
@@ -27,14 +33,60 @@ struct wlr_damage_ring {
 
 	// private state
 
-	pixman_region32_t previous[WLR_DAMAGE_RING_PREVIOUS_LEN];
+	pixman_region32_t *previous; // ring buffer of previous_len regions
+	size_t previous_len;
 	size_t previous_idx;
+
+	uint32_t rect_cost;
+
+	// When tile_size > 0 and the ring has bounds, the history is kept in
+	// previous_tiles instead of previous
+	int tile_size;
+	struct tile_bitmap *previous_tiles; // previous_len + 1 entries, the
+	                                    // last one is scratch space
 };
 
 void wlr_damage_ring_init(struct wlr_damage_ring *ring);
 
 void wlr_damage_ring_finish(struct wlr_damage_ring *ring);
 
+/**
+ * Set the number of previous frames the ring keeps damage for.
+ *
+ * Buffers older than this get damaged fully. Swapchains with more than three
+ * buffers need a longer history for partial redraws to keep working. The most
+ * recent history is preserved.
+ *
+ * Returns false on allocation failure, in which case the ring is left
+ * unchanged.
+ */
+bool wlr_damage_ring_set_previous_len(struct wlr_damage_ring *ring,
+	size_t len);
+
+/**
+ * Set the cost of redrawing one more rectangle, expressed as the number of
+ * pixels which could be redrawn instead.
+ *
+ * wlr_damage_ring_get_buffer_damage() merges nearby damage rectangles as long
+ * as the extra redrawn area costs less than the rectangles saved. Renderers
+ * provide a suitable value in wlr_renderer.damage_rect_cost.
+ *
+ * Defaults to WLR_DAMAGE_RING_DEFAULT_RECT_COST.
+ */
+void wlr_damage_ring_set_rect_cost(struct wlr_damage_ring *ring,
+	uint32_t cost);
+
+/**
+ * Track the damage history with a bitmap of tile_size x tile_size tiles
+ * instead of regions. Zero disables tiles, which is the default.
+ *
+ * Accumulating the damage of previous frames then costs the same regardless
+ * of how fragmented it is, at the price of rounding it up to whole tiles.
+ * This only has an effect on rings with bounds.
+ */
+void wlr_damage_ring_set_tile_size(struct wlr_damage_ring *ring,
+	int tile_size);
+
 /**
  * Set ring bounds and damage the ring fully.
  *
@@ -77,6 +129,9 @@ void wlr_damage_ring_rotate(struct wlr_damage_ring *ring);
  * Get accumulated damage, which is the difference between the current buffer
  * and the buffer with age of buffer_age; in context of rendering, this is
  * the region that needs to be redrawn.
+ *
+ * The returned region may be larger than the accumulated damage, see
+ * wlr_damage_ring_set_rect_cost().
  */
 void wlr_damage_ring_get_buffer_damage(struct wlr_damage_ring *ring,
 	int buffer_age, pixman_region32_t *damage);
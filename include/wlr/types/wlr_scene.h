@@ -43,6 +43,7 @@ struct wlr_scene_output_layout;
 struct wlr_presentation;
 struct wlr_linux_dmabuf_v1;
 struct wlr_output_state;
+struct tile_bitmap;
 
 typedef bool (*wlr_scene_buffer_point_accepts_input_func_t)(
 	struct wlr_scene_buffer *buffer, double *sx, double *sy);
@@ -77,6 +78,12 @@ struct wlr_scene_node {
 	// private state
 
 	pixman_region32_t visible;
+
+	// Cached opaque region, in layout coordinates with the node positioned
+	// at (opaque_x, opaque_y)
+	pixman_region32_t opaque;
+	int opaque_x, opaque_y;
+	bool opaque_dirty;
 };
 
 enum wlr_scene_debug_damage_option {
@@ -90,6 +97,26 @@ struct wlr_scene_tree {
 	struct wlr_scene_node node;
 
 	struct wl_list children; // wlr_scene_node.link
+
+	// private state
+
+	// Bounding box of all enabled descendants, relative to this tree
+	struct wlr_box bounds;
+	bool bounds_dirty;
+
+	// Render-to-texture caches, see wlr_scene_tree_set_cached()
+	bool cached;
+	uint64_t cache_generation; // incremented when the contents change
+	struct wl_array caches; // struct wlr_scene_tree_cache
+	// Union of the visible regions of all descendants
+	pixman_region32_t cache_visible;
+	uint64_t cache_visible_generation;
+};
+
+/** Recycled allocations of a scene node type, private to struct wlr_scene. */
+struct wlr_scene_node_cache {
+	void *free; // linked through the first pointer of each entry
+	size_t len;
 };
 
 /** The root scene-graph node. */
@@ -110,6 +137,22 @@ struct wlr_scene {
 	enum wlr_scene_debug_damage_option debug_damage_option;
 	bool direct_scanout;
 	bool calculate_visibility;
+	int occluded_frame_interval; // ms
+	int damage_tile_size;
+
+	// Recycled node allocations, indexed by enum wlr_scene_node_type
+	struct wlr_scene_node_cache node_cache[WLR_SCENE_NODE_BUFFER + 1];
+
+	uint64_t generation; // incremented on each scene-graph change
+
+	// Result of the last wlr_scene_node_at() call
+	struct {
+		struct wlr_scene_node *root, *node;
+		uint64_t generation;
+		int x, y; // position of node in layout coordinates
+		// Area in layout coordinates where no other node is above node
+		pixman_region32_t region;
+	} node_at_cache;
 };
 
 /** A scene-graph node displaying a single surface. */
@@ -185,6 +228,7 @@ struct wlr_scene_buffer {
 	// private state
 
 	uint64_t active_outputs;
+	int64_t occluded_frame_done_msec;
 	struct wlr_texture *texture;
 	struct wlr_linux_dmabuf_feedback_v1_init_options prev_feedback_options;
 };
@@ -216,13 +260,52 @@ struct wlr_scene_output {
 	struct wl_list damage_highlight_regions;
 
 	struct wl_array render_list;
+	// Set when the render list needs to be reconstructed on the next frame
+	bool render_list_dirty;
+	struct wlr_box render_list_box;
+
+	size_t max_layers;
+	struct wl_array layers; // struct scene_output_layer
+	struct wl_array layer_states; // struct wlr_output_layer_state
+
+	// Tiles of the damage of the frame being rendered, only used with
+	// wlr_scene_set_damage_tile_size()
+	struct tile_bitmap *damage_tiles; // may be NULL
 };
 
 struct wlr_scene_timer {
 	int64_t pre_render_duration;
+	// Whether the render list from the previous frame could be reused
+	bool render_list_reused;
 	struct wlr_render_timer *render_timer;
 };
 
+/**
+ * Statistics about a frame built by wlr_scene_output_build_state(), useful to
+ * understand why a frame was expensive.
+ */
+struct wlr_scene_output_stats {
+	size_t render_list_len;
+	// Nodes considered while constructing the render list, zero when the
+	// render list of the previous frame has been reused
+	size_t nodes_visited;
+
+	// Damage repainted in this frame, in buffer-local coordinates
+	size_t damage_rects;
+	uint64_t damage_area;
+
+	// Background area which didn't need to be painted because of opaque
+	// nodes, and number of render list entries which contributed to it
+	uint64_t culled_area;
+	size_t opaque_cull_hits;
+
+	// Textures created from scene buffers while rendering
+	size_t texture_uploads;
+
+	bool direct_scanout;
+	size_t offloaded_layers;
+};
+
 /** A layer shell scene helper */
 struct wlr_scene_layer_surface_v1 {
 	struct wlr_scene_tree *tree;
@@ -318,12 +401,49 @@ void wlr_scene_set_presentation(struct wlr_scene *scene,
 void wlr_scene_set_linux_dmabuf_v1(struct wlr_scene *scene,
 	struct wlr_linux_dmabuf_v1 *linux_dmabuf_v1);
 
+/**
+ * Set the minimum interval between frame callbacks sent to fully occluded
+ * buffers by wlr_scene_output_send_frame_done(), in milliseconds.
+ *
+ * Buffers which are completely covered by opaque nodes don't have a primary
+ * output, so by default they don't receive frame callbacks until they become
+ * visible again. Setting a non-zero interval lets them keep updating at a
+ * reduced rate instead.
+ */
+void wlr_scene_set_occluded_frame_interval(struct wlr_scene *scene,
+	int interval_ms);
+
+/**
+ * Track the damage of scene outputs with tiles of tile_size x tile_size
+ * pixels, see wlr_damage_ring_set_tile_size(). Rendering also skips nodes
+ * outside of the damaged tiles without looking at their visible region.
+ *
+ * This keeps the cost of fragmented damage, like terminals or spreadsheets
+ * updating many small areas, proportional to the number of tiles instead of
+ * the number of rectangles. Zero disables tiles, which is the default.
+ */
+void wlr_scene_set_damage_tile_size(struct wlr_scene *scene, int tile_size);
+
 
 /**
  * Add a node displaying nothing but its children.
  */
 struct wlr_scene_tree *wlr_scene_tree_create(struct wlr_scene_tree *parent);
 
+/**
+ * Enable or disable caching of the tree contents. A cached tree is rendered
+ * into an intermediate buffer, which is then composited as a single texture.
+ * The buffer is only re-rendered when one of its descendants changes.
+ *
+ * This is useful for trees made of many nodes which rarely change, such as
+ * panels and docks. Descendants of a cached tree are never directly scanned
+ * out nor put on output layers. The cache is rendered at the scale of the
+ * output being rendered, a few caches are kept so that a cached tree
+ * spanning outputs with different scales isn't re-rendered for each of
+ * them.
+ */
+void wlr_scene_tree_set_cached(struct wlr_scene_tree *tree, bool cached);
+
 /**
  * Add a node displaying a single surface to the scene-graph.
  *
@@ -469,8 +589,25 @@ void wlr_scene_output_destroy(struct wlr_scene_output *scene_output);
 void wlr_scene_output_set_position(struct wlr_scene_output *scene_output,
 	int lx, int ly);
 
+/**
+ * Set the maximum number of buffer nodes which may be offloaded to output
+ * layers (see struct wlr_output_layer) instead of being composited by the
+ * renderer.
+ *
+ * The topmost buffer nodes displayed on the output are proposed to the backend
+ * as output layers. The ones rejected by the backend, and all of the nodes
+ * below them, are composited as usual.
+ *
+ * Zero disables output layers, this is the default. When enabled, the scene
+ * output must be the only user of output layers on its output.
+ */
+void wlr_scene_output_set_max_layers(struct wlr_scene_output *scene_output,
+	size_t max_layers);
+
 struct wlr_scene_output_state_options {
 	struct wlr_scene_timer *timer;
+	// May be NULL. Filled with statistics about the frame.
+	struct wlr_scene_output_stats *stats;
 };
 
 /**
@@ -498,6 +635,9 @@ void wlr_scene_timer_finish(struct wlr_scene_timer *timer);
  * Call wlr_surface_send_frame_done() on all surfaces in the scene rendered by
  * wlr_scene_output_commit() for which wlr_scene_surface.primary_output
  * matches the given scene_output.
+ *
+ * Fully occluded surfaces on this output are throttled according to
+ * wlr_scene_set_occluded_frame_interval().
  */
 void wlr_scene_output_send_frame_done(struct wlr_scene_output *scene_output,
 	struct timespec *now);
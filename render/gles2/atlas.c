@@ -0,0 +1,259 @@
+#include <assert.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <stdlib.h>
+#include <wlr/util/log.h>
+#include "render/gles2.h"
+
+// Textures up to this size are packed
+#define ATLAS_MAX_SIZE 256
+// Shelf heights are rounded up to a multiple of this, so that shelves can
+// be re-used by textures of similar sizes
+#define ATLAS_SHELF_ALIGN 8
+// Each texture is surrounded by a copy of its edges, for filtering. A
+// single texel is enough for bilinear filtering, and lets each edge be
+// uploaded from a single source row or column.
+#define ATLAS_PADDING 1
+
+static struct wlr_gles2_atlas_page *page_create(
+		struct wlr_gles2_renderer *renderer,
+		const struct wlr_gles2_pixel_format *fmt) {
+	struct wlr_gles2_atlas_page *page = calloc(1, sizeof(*page));
+	if (page == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	page->renderer = renderer;
+	page->drm_format = fmt->drm_format;
+	wl_array_init(&page->shelves);
+
+	GLint internal_format = fmt->gl_internalformat;
+	if (!internal_format) {
+		internal_format = fmt->gl_format;
+	}
+
+	push_gles2_debug(renderer);
+	glGenTextures(1, &page->tex);
+	glBindTexture(GL_TEXTURE_2D, page->tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, internal_format, GLES2_ATLAS_PAGE_SIZE,
+		GLES2_ATLAS_PAGE_SIZE, 0, fmt->gl_format, fmt->gl_type, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	pop_gles2_debug(renderer);
+
+	wl_list_insert(&renderer->atlas_pages, &page->link);
+	return page;
+}
+
+static void page_destroy(struct wlr_gles2_atlas_page *page) {
+	push_gles2_debug(page->renderer);
+	glDeleteTextures(1, &page->tex);
+	pop_gles2_debug(page->renderer);
+
+	wl_list_remove(&page->link);
+	wl_array_release(&page->shelves);
+	free(page);
+}
+
+static bool page_alloc(struct wlr_gles2_atlas_page *page, int width, int height,
+		struct wlr_box *box) {
+	int shelf_height = (height + ATLAS_SHELF_ALIGN - 1) /
+		ATLAS_SHELF_ALIGN * ATLAS_SHELF_ALIGN;
+
+	struct wlr_gles2_atlas_shelf *best = NULL, *shelf;
+	int next_y = 0;
+	wl_array_for_each(shelf, &page->shelves) {
+		next_y = shelf->y + shelf->height;
+		// Don't waste more than half of a shelf's height, compared to the
+		// shelf which would be created for the texture
+		if (shelf->height < height || shelf->height > 2 * shelf_height ||
+				shelf->x + width > GLES2_ATLAS_PAGE_SIZE) {
+			continue;
+		}
+		if (best == NULL || shelf->height < best->height) {
+			best = shelf;
+		}
+	}
+
+	if (best == NULL) {
+		if (next_y + shelf_height > GLES2_ATLAS_PAGE_SIZE) {
+			return false;
+		}
+		best = wl_array_add(&page->shelves, sizeof(*best));
+		if (best == NULL) {
+			return false;
+		}
+		*best = (struct wlr_gles2_atlas_shelf){
+			.y = next_y,
+			.height = shelf_height,
+		};
+	}
+
+	*box = (struct wlr_box){
+		.x = best->x,
+		.y = best->y,
+		.width = width,
+		.height = height,
+	};
+	best->x += width;
+	best->textures_len++;
+	page->textures_len++;
+	return true;
+}
+
+bool gles2_atlas_add_texture(struct wlr_gles2_renderer *renderer,
+		struct wlr_gles2_texture *texture, const struct wlr_gles2_pixel_format *fmt) {
+	int width = texture->wlr_texture.width;
+	int height = texture->wlr_texture.height;
+	if (!renderer->atlas_enabled || width > ATLAS_MAX_SIZE ||
+			height > ATLAS_MAX_SIZE) {
+		return false;
+	}
+
+	int padded_width = width + 2 * ATLAS_PADDING;
+	int padded_height = height + 2 * ATLAS_PADDING;
+
+	struct wlr_box box;
+	struct wlr_gles2_atlas_page *page, *found = NULL;
+	wl_list_for_each(page, &renderer->atlas_pages, link) {
+		if (page->drm_format == fmt->drm_format &&
+				page_alloc(page, padded_width, padded_height, &box)) {
+			found = page;
+			break;
+		}
+	}
+
+	if (found == NULL) {
+		found = page_create(renderer, fmt);
+		if (found == NULL) {
+			return false;
+		}
+		if (!page_alloc(found, padded_width, padded_height, &box)) {
+			page_destroy(found);
+			return false;
+		}
+	}
+
+	texture->tex = found->tex;
+	texture->atlas = found;
+	texture->atlas_box = (struct wlr_box){
+		.x = box.x + ATLAS_PADDING,
+		.y = box.y + ATLAS_PADDING,
+		.width = width,
+		.height = height,
+	};
+	return true;
+}
+
+void gles2_atlas_remove_texture(struct wlr_gles2_texture *texture) {
+	struct wlr_gles2_atlas_page *page = texture->atlas;
+	assert(page != NULL);
+	texture->atlas = NULL;
+	texture->tex = 0;
+
+	if (--page->textures_len == 0) {
+		page_destroy(page);
+		return;
+	}
+
+	// Space in the middle of a shelf is only re-used once all of its
+	// textures are gone, but the space of the last texture of a shelf is
+	// given back right away
+	int x = texture->atlas_box.x - ATLAS_PADDING;
+	int y = texture->atlas_box.y - ATLAS_PADDING;
+	struct wlr_gles2_atlas_shelf *shelf;
+	wl_array_for_each(shelf, &page->shelves) {
+		if (shelf->y == y) {
+			assert(shelf->textures_len > 0);
+			if (--shelf->textures_len == 0) {
+				shelf->x = 0;
+			} else if (shelf->x == x + texture->atlas_box.width + 2 * ATLAS_PADDING) {
+				shelf->x = x;
+			}
+			break;
+		}
+	}
+
+	// Give the space of empty shelves at the bottom back to the page, so
+	// that it can be split differently
+	struct wlr_gles2_atlas_shelf *shelves = page->shelves.data;
+	size_t shelves_len = page->shelves.size / sizeof(shelves[0]);
+	while (shelves_len > 0 && shelves[shelves_len - 1].textures_len == 0) {
+		shelves_len--;
+	}
+	page->shelves.size = shelves_len * sizeof(shelves[0]);
+}
+
+static void upload_part(const struct wlr_gles2_pixel_format *fmt,
+		const void *data, int dst_x, int dst_y, int src_x, int src_y,
+		int width, int height) {
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, src_x);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, src_y);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, dst_x, dst_y, width, height,
+		fmt->gl_format, fmt->gl_type, data);
+}
+
+void gles2_atlas_upload(struct wlr_gles2_texture *texture,
+		const struct wlr_gles2_pixel_format *fmt, uint32_t bytes_per_pixel,
+		const pixman_region32_t *region, const void *data, size_t stride) {
+	const struct wlr_box *atlas_box = &texture->atlas_box;
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, stride / bytes_per_pixel);
+
+	int rects_len = 0;
+	const pixman_box32_t *rects = pixman_region32_rectangles(region, &rects_len);
+	for (int i = 0; i < rects_len; i++) {
+		pixman_box32_t rect = rects[i];
+
+		// Columns and rows to upload as { dst, src, size }, in texture
+		// coordinates: the rectangle, then the edges it touches
+		int cols[3][3], rows[3][3];
+		size_t cols_len = 0, rows_len = 0;
+		cols[cols_len][0] = rect.x1;
+		cols[cols_len][1] = rect.x1;
+		cols[cols_len++][2] = rect.x2 - rect.x1;
+		if (rect.x1 == 0) {
+			cols[cols_len][0] = -ATLAS_PADDING;
+			cols[cols_len][1] = 0;
+			cols[cols_len++][2] = ATLAS_PADDING;
+		}
+		if (rect.x2 == atlas_box->width) {
+			cols[cols_len][0] = atlas_box->width;
+			cols[cols_len][1] = atlas_box->width - 1;
+			cols[cols_len++][2] = ATLAS_PADDING;
+		}
+		rows[rows_len][0] = rect.y1;
+		rows[rows_len][1] = rect.y1;
+		rows[rows_len++][2] = rect.y2 - rect.y1;
+		if (rect.y1 == 0) {
+			rows[rows_len][0] = -ATLAS_PADDING;
+			rows[rows_len][1] = 0;
+			rows[rows_len++][2] = ATLAS_PADDING;
+		}
+		if (rect.y2 == atlas_box->height) {
+			rows[rows_len][0] = atlas_box->height;
+			rows[rows_len][1] = atlas_box->height - 1;
+			rows[rows_len++][2] = ATLAS_PADDING;
+		}
+
+		for (size_t r = 0; r < rows_len; r++) {
+			for (size_t c = 0; c < cols_len; c++) {
+				upload_part(fmt, data,
+					atlas_box->x + cols[c][0], atlas_box->y + rows[r][0],
+					cols[c][1], rows[r][1], cols[c][2], rows[r][2]);
+			}
+		}
+	}
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+}
+
+void gles2_atlas_finish(struct wlr_gles2_renderer *renderer) {
+	struct wlr_gles2_atlas_page *page, *tmp;
+	wl_list_for_each_safe(page, tmp, &renderer->atlas_pages, link) {
+		page_destroy(page);
+	}
+}
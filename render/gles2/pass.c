@@ -1,5 +1,7 @@
 #define _POSIX_C_SOURCE 199309L
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <pixman.h>
 #include <time.h>
@@ -7,8 +9,6 @@
 #include "render/gles2.h"
 #include "types/wlr_matrix.h"
 
-#define MAX_QUADS 86 // 4kb
-
 static const struct wlr_render_pass_impl render_pass_impl;
 
 static struct wlr_gles2_render_pass *get_render_pass(struct wlr_render_pass *wlr_pass) {
@@ -17,6 +17,146 @@ static struct wlr_gles2_render_pass *get_render_pass(struct wlr_render_pass *wlr
 	return pass;
 }
 
+#define MIN_VBO_SIZE (64 * 1024)
+
+/**
+ * Upload vertices into the renderer's vertex buffer and return their offset.
+ * The buffer is used as a ring, so that the data of previous passes doesn't
+ * need to be overwritten while the GPU may still be reading it.
+ */
+static bool upload_vertices(struct wlr_gles2_renderer *renderer,
+		const void *data, size_t size, size_t *offset) {
+	if (renderer->vbo == 0) {
+		glGenBuffers(1, &renderer->vbo);
+		if (renderer->vbo == 0) {
+			return false;
+		}
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, renderer->vbo);
+	if (size > renderer->vbo_size) {
+		size_t vbo_size = renderer->vbo_size * 2;
+		if (vbo_size < MIN_VBO_SIZE) {
+			vbo_size = MIN_VBO_SIZE;
+		}
+		if (vbo_size < size) {
+			vbo_size = size;
+		}
+		glBufferData(GL_ARRAY_BUFFER, vbo_size, NULL, GL_STREAM_DRAW);
+		renderer->vbo_size = vbo_size;
+		renderer->vbo_offset = 0;
+	} else if (renderer->vbo_offset + size > renderer->vbo_size) {
+		// Orphan the storage, the driver can keep the old one alive until
+		// previous draws are done with it
+		glBufferData(GL_ARRAY_BUFFER, renderer->vbo_size, NULL, GL_STREAM_DRAW);
+		renderer->vbo_offset = 0;
+	}
+
+	glBufferSubData(GL_ARRAY_BUFFER, renderer->vbo_offset, size, data);
+	*offset = renderer->vbo_offset;
+	renderer->vbo_offset += size;
+	return true;
+}
+
+static void set_attrib_pointer(GLint attrib, GLint size, size_t offset) {
+	if (attrib < 0) {
+		return;
+	}
+	glEnableVertexAttribArray(attrib);
+	glVertexAttribPointer(attrib, size, GL_FLOAT, GL_FALSE,
+		sizeof(struct wlr_gles2_vertex), (const void *)(uintptr_t)offset);
+}
+
+static void unset_attrib_pointer(GLint attrib) {
+	if (attrib >= 0) {
+		glDisableVertexAttribArray(attrib);
+	}
+}
+
+static void flush_draws(struct wlr_gles2_render_pass *pass) {
+	struct wlr_gles2_renderer *renderer = pass->buffer->renderer;
+	struct wlr_buffer *wlr_buffer = pass->buffer->buffer;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, pass->buffer->fbo);
+	glViewport(0, 0, wlr_buffer->width, wlr_buffer->height);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	glDisable(GL_SCISSOR_TEST);
+
+	if (pass->draws.size == 0) {
+		return;
+	}
+
+	size_t base;
+	if (!upload_vertices(renderer, pass->vertices.data, pass->vertices.size, &base)) {
+		wlr_log(WLR_ERROR, "Failed to upload vertices");
+		return;
+	}
+
+	const struct wlr_gles2_shader *shader = NULL;
+	int blend = -1;
+	GLuint tex = 0;
+	GLenum target = 0;
+
+	const struct wlr_gles2_draw *draw;
+	wl_array_for_each(draw, &pass->draws) {
+		if (draw->shader != shader) {
+			if (shader != NULL) {
+				unset_attrib_pointer(shader->pos_attrib);
+				unset_attrib_pointer(shader->texcoord_attrib);
+				unset_attrib_pointer(shader->color_attrib);
+			}
+			shader = draw->shader;
+
+			glUseProgram(shader->program);
+			glUniformMatrix3fv(shader->proj, 1, GL_FALSE, pass->projection_matrix);
+			if (shader->tex >= 0) {
+				glUniform1i(shader->tex, 0);
+			}
+
+			set_attrib_pointer(shader->pos_attrib, 2,
+				base + offsetof(struct wlr_gles2_vertex, pos));
+			set_attrib_pointer(shader->texcoord_attrib, 2,
+				base + offsetof(struct wlr_gles2_vertex, texcoord));
+			set_attrib_pointer(shader->color_attrib, 4,
+				base + offsetof(struct wlr_gles2_vertex, color));
+		}
+
+		if (draw->blend != blend) {
+			blend = draw->blend;
+			if (blend) {
+				glEnable(GL_BLEND);
+			} else {
+				glDisable(GL_BLEND);
+			}
+		}
+
+		if (draw->target != 0) {
+			if (draw->tex != tex || draw->target != target) {
+				if (target != 0 && target != draw->target) {
+					glBindTexture(target, 0);
+				}
+				tex = draw->tex;
+				target = draw->target;
+				glActiveTexture(GL_TEXTURE0);
+				glBindTexture(target, tex);
+			}
+
+			glTexParameteri(target, GL_TEXTURE_MIN_FILTER, draw->filter);
+			glTexParameteri(target, GL_TEXTURE_MAG_FILTER, draw->filter);
+		}
+
+		glDrawArrays(GL_TRIANGLES, (GLint)draw->first, (GLsizei)draw->count);
+	}
+
+	unset_attrib_pointer(shader->pos_attrib);
+	unset_attrib_pointer(shader->texcoord_attrib);
+	unset_attrib_pointer(shader->color_attrib);
+	if (target != 0) {
+		glBindTexture(target, 0);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
 static bool render_pass_submit(struct wlr_render_pass *wlr_pass) {
 	struct wlr_gles2_render_pass *pass = get_render_pass(wlr_pass);
 	struct wlr_gles2_renderer *renderer = pass->buffer->renderer;
@@ -24,6 +164,8 @@ static bool render_pass_submit(struct wlr_render_pass *wlr_pass) {
 
 	push_gles2_debug(renderer);
 
+	flush_draws(pass);
+
 	if (timer) {
 		// clear disjoint flag
 		GLint64 disjoint;
@@ -42,12 +184,49 @@ static bool render_pass_submit(struct wlr_render_pass *wlr_pass) {
 	pop_gles2_debug(renderer);
 
 	wlr_buffer_unlock(pass->buffer->buffer);
+	wl_array_release(&pass->vertices);
+	wl_array_release(&pass->draws);
 	free(pass);
 
 	return true;
 }
 
-static void render(const struct wlr_box *box, const pixman_region32_t *clip, GLint attrib) {
+/**
+ * Get the draw the next vertices are appended to, starting a new one if the
+ * state differs from the last draw.
+ */
+static struct wlr_gles2_draw *get_draw(struct wlr_gles2_render_pass *pass,
+		const struct wlr_gles2_draw *state) {
+	size_t first = pass->vertices.size / sizeof(struct wlr_gles2_vertex);
+
+	if (pass->draws.size > 0) {
+		struct wlr_gles2_draw *last = (struct wlr_gles2_draw *)
+			((char *)pass->draws.data + pass->draws.size) - 1;
+		if (last->shader == state->shader && last->target == state->target &&
+				last->tex == state->tex && last->filter == state->filter &&
+				last->blend == state->blend) {
+			return last;
+		}
+	}
+
+	struct wlr_gles2_draw *draw = wl_array_add(&pass->draws, sizeof(*draw));
+	if (draw == NULL) {
+		return NULL;
+	}
+	*draw = *state;
+	draw->first = first;
+	draw->count = 0;
+	return draw;
+}
+
+/**
+ * Record the part of the box not clipped away. The texture coordinates are
+ * computed from the box-local ones with tex_matrix, which may be NULL.
+ */
+static void add_quads(struct wlr_gles2_render_pass *pass,
+		const struct wlr_gles2_draw *state, const struct wlr_box *box,
+		const pixman_region32_t *clip, const float tex_matrix[static 9],
+		const float color[static 4]) {
 	pixman_region32_t region;
 	pixman_region32_init_rect(&region, box->x, box->y, box->width, box->height);
 
@@ -62,52 +241,52 @@ static void render(const struct wlr_box *box, const pixman_region32_t *clip, GLi
 		return;
 	}
 
-	glEnableVertexAttribArray(attrib);
+	struct wlr_gles2_draw *draw = get_draw(pass, state);
+	struct wlr_gles2_vertex *verts = wl_array_add(&pass->vertices,
+		rects_len * 6 * sizeof(*verts));
+	if (draw == NULL || verts == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		pixman_region32_fini(&region);
+		return;
+	}
 
-	for (int i = 0; i < rects_len;) {
-		int batch = rects_len - i < MAX_QUADS ? rects_len - i : MAX_QUADS;
-		int batch_end = batch + i;
-
-		size_t vert_index = 0;
-		GLfloat verts[MAX_QUADS * 6 * 2];
-		for (; i < batch_end; i++) {
-			const pixman_box32_t *rect = &rects[i];
-
-			verts[vert_index++] = (GLfloat)(rect->x1 - box->x) / box->width;
-			verts[vert_index++] = (GLfloat)(rect->y1 - box->y) / box->height;
-			verts[vert_index++] = (GLfloat)(rect->x2 - box->x) / box->width;
-			verts[vert_index++] = (GLfloat)(rect->y1 - box->y) / box->height;
-			verts[vert_index++] = (GLfloat)(rect->x1 - box->x) / box->width;
-			verts[vert_index++] = (GLfloat)(rect->y2 - box->y) / box->height;
-			verts[vert_index++] = (GLfloat)(rect->x2 - box->x) / box->width;
-			verts[vert_index++] = (GLfloat)(rect->y1 - box->y) / box->height;
-			verts[vert_index++] = (GLfloat)(rect->x2 - box->x) / box->width;
-			verts[vert_index++] = (GLfloat)(rect->y2 - box->y) / box->height;
-			verts[vert_index++] = (GLfloat)(rect->x1 - box->x) / box->width;
-			verts[vert_index++] = (GLfloat)(rect->y2 - box->y) / box->height;
+	for (int i = 0; i < rects_len; i++) {
+		const pixman_box32_t *rect = &rects[i];
+		// Two triangles: top-left, top-right, bottom-left and top-right,
+		// bottom-right, bottom-left
+		const int32_t corners[6][2] = {
+			{ rect->x1, rect->y1 },
+			{ rect->x2, rect->y1 },
+			{ rect->x1, rect->y2 },
+			{ rect->x2, rect->y1 },
+			{ rect->x2, rect->y2 },
+			{ rect->x1, rect->y2 },
+		};
+
+		for (size_t j = 0; j < 6; j++) {
+			struct wlr_gles2_vertex *vert = &verts[i * 6 + j];
+			vert->pos[0] = corners[j][0];
+			vert->pos[1] = corners[j][1];
+
+			if (tex_matrix != NULL) {
+				GLfloat x = (GLfloat)(corners[j][0] - box->x) / box->width;
+				GLfloat y = (GLfloat)(corners[j][1] - box->y) / box->height;
+				vert->texcoord[0] = tex_matrix[0] * x + tex_matrix[1] * y + tex_matrix[2];
+				vert->texcoord[1] = tex_matrix[3] * x + tex_matrix[4] * y + tex_matrix[5];
+			} else {
+				vert->texcoord[0] = vert->texcoord[1] = 0;
+			}
+
+			memcpy(vert->color, color, sizeof(vert->color));
 		}
-
-		glVertexAttribPointer(attrib, 2, GL_FLOAT, GL_FALSE, 0, verts);
-		glDrawArrays(GL_TRIANGLES, 0, batch * 6);
 	}
-
-	glDisableVertexAttribArray(attrib);
+	draw->count += rects_len * 6;
 
 	pixman_region32_fini(&region);
 }
 
-static void set_proj_matrix(GLint loc, float proj[9], const struct wlr_box *box) {
-	float gl_matrix[9];
-	wlr_matrix_identity(gl_matrix);
-	wlr_matrix_translate(gl_matrix, box->x, box->y);
-	wlr_matrix_scale(gl_matrix, box->width, box->height);
-	wlr_matrix_multiply(gl_matrix, proj, gl_matrix);
-	glUniformMatrix3fv(loc, 1, GL_FALSE, gl_matrix);
-}
-
-static void set_tex_matrix(GLint loc, enum wl_output_transform trans,
-		const struct wlr_fbox *box) {
-	float tex_matrix[9];
+static void get_tex_matrix(float tex_matrix[static 9],
+		enum wl_output_transform trans, const struct wlr_fbox *box) {
 	wlr_matrix_identity(tex_matrix);
 	wlr_matrix_translate(tex_matrix, box->x, box->y);
 	wlr_matrix_scale(tex_matrix, box->width, box->height);
@@ -121,19 +300,16 @@ static void set_tex_matrix(GLint loc, enum wl_output_transform trans,
 		wlr_matrix_transform(tex_matrix, trans);
 	}
 	wlr_matrix_translate(tex_matrix, -.5, -.5);
-
-	glUniformMatrix3fv(loc, 1, GL_FALSE, tex_matrix);
 }
 
-static void setup_blending(enum wlr_render_blend_mode mode) {
+static bool get_blending(enum wlr_render_blend_mode mode) {
 	switch (mode) {
 	case WLR_RENDER_BLEND_MODE_PREMULTIPLIED:
-		glEnable(GL_BLEND);
-		break;
+		return true;
 	case WLR_RENDER_BLEND_MODE_NONE:
-		glDisable(GL_BLEND);
-		break;
+		return false;
 	}
+	abort(); // unreachable
 }
 
 static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
@@ -142,7 +318,7 @@ static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 	struct wlr_gles2_renderer *renderer = pass->buffer->renderer;
 	struct wlr_gles2_texture *texture = gles2_get_texture(options->texture);
 
-	struct wlr_gles2_tex_shader *shader = NULL;
+	struct wlr_gles2_shader *shader = NULL;
 
 	switch (texture->target) {
 	case GL_TEXTURE_2D:
@@ -168,40 +344,29 @@ static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 	wlr_render_texture_options_get_dst_box(options, &dst_box);
 	float alpha = wlr_render_texture_options_get_alpha(options);
 
-	src_fbox.x /= options->texture->width;
-	src_fbox.y /= options->texture->height;
-	src_fbox.width /= options->texture->width;
-	src_fbox.height /= options->texture->height;
-
-	push_gles2_debug(renderer);
-	setup_blending(!texture->has_alpha && alpha == 1.0 ?
-		WLR_RENDER_BLEND_MODE_NONE : options->blend_mode);
-
-	glUseProgram(shader->program);
-
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(texture->target, texture->tex);
+	gles2_texture_normalize_box(texture, &src_fbox);
 
+	struct wlr_gles2_draw state = {
+		.shader = shader,
+		.target = texture->target,
+		.tex = texture->tex,
+		.blend = get_blending(!texture->has_alpha && alpha == 1.0 ?
+			WLR_RENDER_BLEND_MODE_NONE : options->blend_mode),
+	};
 	switch (options->filter_mode) {
 	case WLR_SCALE_FILTER_BILINEAR:
-		glTexParameteri(texture->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(texture->target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		state.filter = GL_LINEAR;
 		break;
 	case WLR_SCALE_FILTER_NEAREST:
-		glTexParameteri(texture->target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(texture->target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		state.filter = GL_NEAREST;
 		break;
 	}
 
-	glUniform1i(shader->tex, 0);
-	glUniform1f(shader->alpha, alpha);
-	set_proj_matrix(shader->proj, pass->projection_matrix, &dst_box);
-	set_tex_matrix(shader->tex_proj, options->transform, &src_fbox);
-
-	render(&dst_box, options->clip, shader->pos_attrib);
+	float tex_matrix[9];
+	get_tex_matrix(tex_matrix, options->transform, &src_fbox);
 
-	glBindTexture(texture->target, 0);
-	pop_gles2_debug(renderer);
+	const float color[4] = { alpha, alpha, alpha, alpha };
+	add_quads(pass, &state, &dst_box, options->clip, tex_matrix, color);
 }
 
 static void render_pass_add_rect(struct wlr_render_pass *wlr_pass,
@@ -213,17 +378,14 @@ static void render_pass_add_rect(struct wlr_render_pass *wlr_pass,
 	struct wlr_box box;
 	wlr_render_rect_options_get_box(options, pass->buffer->buffer, &box);
 
-	push_gles2_debug(renderer);
-	setup_blending(color->a == 1.0 ? WLR_RENDER_BLEND_MODE_NONE : options->blend_mode);
-
-	glUseProgram(renderer->shaders.quad.program);
-
-	set_proj_matrix(renderer->shaders.quad.proj, pass->projection_matrix, &box);
-	glUniform4f(renderer->shaders.quad.color, color->r, color->g, color->b, color->a);
+	struct wlr_gles2_draw state = {
+		.shader = &renderer->shaders.quad,
+		.blend = get_blending(color->a == 1.0 ?
+			WLR_RENDER_BLEND_MODE_NONE : options->blend_mode),
+	};
 
-	render(&box, options->clip, renderer->shaders.quad.pos_attrib);
-
-	pop_gles2_debug(renderer);
+	const float rgba[4] = { color->r, color->g, color->b, color->a };
+	add_quads(pass, &state, &box, options->clip, NULL, rgba);
 }
 
 static const struct wlr_render_pass_impl render_pass_impl = {
@@ -269,16 +431,11 @@ struct wlr_gles2_render_pass *begin_gles2_buffer_pass(struct wlr_gles2_buffer *b
 	pass->buffer = buffer;
 	pass->timer = timer;
 
+	wl_array_init(&pass->vertices);
+	wl_array_init(&pass->draws);
+
 	matrix_projection(pass->projection_matrix, wlr_buffer->width, wlr_buffer->height,
 		WL_OUTPUT_TRANSFORM_FLIPPED_180);
 
-	push_gles2_debug(renderer);
-	glBindFramebuffer(GL_FRAMEBUFFER, buffer->fbo);
-
-	glViewport(0, 0, wlr_buffer->width, wlr_buffer->height);
-	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
-	glDisable(GL_SCISSOR_TEST);
-	pop_gles2_debug(renderer);
-
 	return pass;
 }
@@ -0,0 +1,240 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+#include "render/gles2.h"
+
+/*
+ * On-disk cache of linked programs, using GL_OES_get_program_binary.
+ *
+ * Each program is stored in its own file, named after a hash of the driver
+ * strings and the shader sources. The file starts with a header repeating
+ * the key, so that stale or truncated files are detected. Any failure falls
+ * back to compiling the program.
+ */
+
+#define PROGRAM_CACHE_MAGIC 0x474f5250524c5700ULL // "\0WLRPROG"
+#define PROGRAM_CACHE_VERSION 1
+
+struct program_cache_header {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t binary_format;
+	uint64_t key;
+	uint64_t binary_len;
+};
+
+static uint64_t hash_str(uint64_t hash, const char *str) {
+	// FNV-1a
+	for (; *str != '\0'; str++) {
+		hash ^= (unsigned char)*str;
+		hash *= 0x100000001b3ULL;
+	}
+	// Separate consecutive strings
+	hash ^= 0xff;
+	hash *= 0x100000001b3ULL;
+	return hash;
+}
+
+static bool make_dir(const char *path) {
+	if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+		wlr_log_errno(WLR_DEBUG, "Failed to create %s", path);
+		return false;
+	}
+	return true;
+}
+
+void gles2_program_cache_init(struct wlr_gles2_renderer *renderer) {
+	GLint formats_len = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats_len);
+	if (formats_len <= 0) {
+		return;
+	}
+
+	const char *cache_home = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	char base[PATH_MAX];
+	if (cache_home != NULL && cache_home[0] == '/') {
+		snprintf(base, sizeof(base), "%s", cache_home);
+	} else if (home != NULL && home[0] == '/') {
+		snprintf(base, sizeof(base), "%s/.cache", home);
+	} else {
+		return;
+	}
+
+	char dir[PATH_MAX];
+	if (snprintf(dir, sizeof(dir), "%s/wlroots", base) >= (int)sizeof(dir) ||
+			!make_dir(base) || !make_dir(dir)) {
+		return;
+	}
+
+	renderer->program_cache.dir = strdup(dir);
+	if (renderer->program_cache.dir == NULL) {
+		return;
+	}
+
+	uint64_t key = 0xcbf29ce484222325ULL;
+	key = hash_str(key, (const char *)glGetString(GL_VENDOR));
+	key = hash_str(key, (const char *)glGetString(GL_RENDERER));
+	key = hash_str(key, (const char *)glGetString(GL_VERSION));
+	renderer->program_cache.driver_key = key;
+}
+
+void gles2_program_cache_finish(struct wlr_gles2_renderer *renderer) {
+	free(renderer->program_cache.dir);
+	renderer->program_cache.dir = NULL;
+}
+
+static uint64_t program_key(struct wlr_gles2_renderer *renderer,
+		const GLchar *vert_src, const GLchar *frag_src) {
+	uint64_t key = renderer->program_cache.driver_key;
+	key = hash_str(key, vert_src);
+	key = hash_str(key, frag_src);
+	return key;
+}
+
+static bool program_path(struct wlr_gles2_renderer *renderer, uint64_t key,
+		char *path, size_t path_size) {
+	int n = snprintf(path, path_size, "%s/gles2-%016llx.bin",
+		renderer->program_cache.dir, (unsigned long long)key);
+	return n > 0 && (size_t)n < path_size;
+}
+
+GLuint gles2_program_cache_load(struct wlr_gles2_renderer *renderer,
+		const GLchar *vert_src, const GLchar *frag_src) {
+	if (renderer->program_cache.dir == NULL) {
+		return 0;
+	}
+
+	uint64_t key = program_key(renderer, vert_src, frag_src);
+	char path[PATH_MAX];
+	if (!program_path(renderer, key, path, sizeof(path))) {
+		return 0;
+	}
+
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		return 0;
+	}
+
+	GLuint prog = 0;
+	void *binary = NULL;
+	struct program_cache_header header;
+	if (fread(&header, sizeof(header), 1, f) != 1 ||
+			header.magic != PROGRAM_CACHE_MAGIC ||
+			header.version != PROGRAM_CACHE_VERSION ||
+			header.key != key || header.binary_len == 0 ||
+			header.binary_len > INT32_MAX) {
+		goto out;
+	}
+
+	binary = malloc(header.binary_len);
+	if (binary == NULL ||
+			fread(binary, header.binary_len, 1, f) != 1) {
+		goto out;
+	}
+
+	push_gles2_debug(renderer);
+	prog = glCreateProgram();
+	renderer->procs.glProgramBinaryOES(prog, header.binary_format, binary,
+		(GLint)header.binary_len);
+	GLint ok = GL_FALSE;
+	glGetProgramiv(prog, GL_LINK_STATUS, &ok);
+	if (ok == GL_FALSE) {
+		// The driver may reject binaries, e.g. after an update that kept
+		// the same version string
+		wlr_log(WLR_DEBUG, "Discarding cached program %s", path);
+		glDeleteProgram(prog);
+		prog = 0;
+	} else {
+		renderer->program_cache.loaded++;
+	}
+	pop_gles2_debug(renderer);
+
+out:
+	free(binary);
+	fclose(f);
+	return prog;
+}
+
+void gles2_program_cache_store(struct wlr_gles2_renderer *renderer,
+		GLuint prog, const GLchar *vert_src, const GLchar *frag_src) {
+	if (renderer->program_cache.dir == NULL) {
+		return;
+	}
+
+	GLint binary_len = 0;
+	glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH_OES, &binary_len);
+	if (binary_len <= 0) {
+		return;
+	}
+
+	void *binary = malloc(binary_len);
+	if (binary == NULL) {
+		return;
+	}
+
+	GLenum binary_format;
+	GLsizei written = 0;
+	push_gles2_debug(renderer);
+	renderer->procs.glGetProgramBinaryOES(prog, binary_len, &written,
+		&binary_format, binary);
+	pop_gles2_debug(renderer);
+	if (written <= 0) {
+		free(binary);
+		return;
+	}
+
+	uint64_t key = program_key(renderer, vert_src, frag_src);
+	char path[PATH_MAX], tmp_path[PATH_MAX];
+	if (!program_path(renderer, key, path, sizeof(path)) ||
+			snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path) >=
+			(int)sizeof(tmp_path)) {
+		free(binary);
+		return;
+	}
+
+	// Write to a temporary file first, so that concurrent compositors never
+	// read a partial file
+	int fd = mkstemp(tmp_path);
+	if (fd < 0) {
+		wlr_log_errno(WLR_DEBUG, "Failed to create %s", tmp_path);
+		free(binary);
+		return;
+	}
+
+	struct program_cache_header header = {
+		.magic = PROGRAM_CACHE_MAGIC,
+		.version = PROGRAM_CACHE_VERSION,
+		.binary_format = binary_format,
+		.key = key,
+		.binary_len = written,
+	};
+	FILE *f = fdopen(fd, "wb");
+	bool ok = f != NULL &&
+		fwrite(&header, sizeof(header), 1, f) == 1 &&
+		fwrite(binary, written, 1, f) == 1;
+	if (f != NULL) {
+		ok = fclose(f) == 0 && ok;
+	} else {
+		close(fd);
+	}
+	if (ok && rename(tmp_path, path) != 0) {
+		ok = false;
+	}
+	if (!ok) {
+		wlr_log_errno(WLR_DEBUG, "Failed to write %s", path);
+		unlink(tmp_path);
+	}
+
+	free(binary);
+}
@@ -20,6 +20,7 @@
 #include "render/gles2.h"
 #include "render/pixel_format.h"
 #include "types/wlr_matrix.h"
+#include "util/env.h"
 #include "util/time.h"
 
 #include "common_vert_src.h"
@@ -294,7 +295,7 @@ static bool gles2_render_subtexture_with_matrix(
 		gles2_get_texture(wlr_texture);
 	assert(texture->renderer == renderer);
 
-	struct wlr_gles2_tex_shader *shader = NULL;
+	struct wlr_gles2_shader *shader = NULL;
 
 	switch (texture->target) {
 	case GL_TEXTURE_2D:
@@ -334,23 +335,27 @@ static bool gles2_render_subtexture_with_matrix(
 
 	glUniformMatrix3fv(shader->proj, 1, GL_FALSE, gl_matrix);
 	glUniform1i(shader->tex, 0);
-	glUniform1f(shader->alpha, alpha);
 
-	float tex_matrix[9];
-	wlr_matrix_identity(tex_matrix);
-	wlr_matrix_translate(tex_matrix, box->x / texture->wlr_texture.width,
-		box->y / texture->wlr_texture.height);
-	wlr_matrix_scale(tex_matrix, box->width / texture->wlr_texture.width,
-		box->height / texture->wlr_texture.height);
-	glUniformMatrix3fv(shader->tex_proj, 1, GL_FALSE, tex_matrix);
+	struct wlr_fbox tex_box = *box;
+	gles2_texture_normalize_box(texture, &tex_box);
+
+	GLfloat texcoord[8];
+	for (size_t i = 0; i < 4; i++) {
+		texcoord[2 * i] = tex_box.x + verts[2 * i] * tex_box.width;
+		texcoord[2 * i + 1] = tex_box.y + verts[2 * i + 1] * tex_box.height;
+	}
 
 	glVertexAttribPointer(shader->pos_attrib, 2, GL_FLOAT, GL_FALSE, 0, verts);
+	glVertexAttribPointer(shader->texcoord_attrib, 2, GL_FLOAT, GL_FALSE, 0, texcoord);
+	glVertexAttrib4f(shader->color_attrib, alpha, alpha, alpha, alpha);
 
 	glEnableVertexAttribArray(shader->pos_attrib);
+	glEnableVertexAttribArray(shader->texcoord_attrib);
 
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
 	glDisableVertexAttribArray(shader->pos_attrib);
+	glDisableVertexAttribArray(shader->texcoord_attrib);
 
 	glBindTexture(texture->target, 0);
 
@@ -377,7 +382,8 @@ static void gles2_render_quad_with_matrix(struct wlr_renderer *wlr_renderer,
 	glUseProgram(renderer->shaders.quad.program);
 
 	glUniformMatrix3fv(renderer->shaders.quad.proj, 1, GL_FALSE, gl_matrix);
-	glUniform4f(renderer->shaders.quad.color, color[0], color[1], color[2], color[3]);
+	glVertexAttrib4f(renderer->shaders.quad.color_attrib,
+		color[0], color[1], color[2], color[3]);
 
 	glVertexAttribPointer(renderer->shaders.quad.pos_attrib, 2, GL_FLOAT, GL_FALSE,
 			0, verts);
@@ -532,11 +538,15 @@ static void gles2_destroy(struct wlr_renderer *wlr_renderer) {
 		gles2_texture_destroy(tex);
 	}
 
+	gles2_atlas_finish(renderer);
+
 	push_gles2_debug(renderer);
 	glDeleteProgram(renderer->shaders.quad.program);
 	glDeleteProgram(renderer->shaders.tex_rgba.program);
 	glDeleteProgram(renderer->shaders.tex_rgbx.program);
 	glDeleteProgram(renderer->shaders.tex_ext.program);
+	glDeleteBuffers(1, &renderer->vbo);
+	glDeleteBuffers(1, &renderer->pbo);
 	pop_gles2_debug(renderer);
 
 	if (renderer->exts.KHR_debug) {
@@ -735,6 +745,11 @@ static GLuint compile_shader(struct wlr_gles2_renderer *renderer,
 
 static GLuint link_program(struct wlr_gles2_renderer *renderer,
 		const GLchar *vert_src, const GLchar *frag_src) {
+	GLuint cached = gles2_program_cache_load(renderer, vert_src, frag_src);
+	if (cached) {
+		return cached;
+	}
+
 	push_gles2_debug(renderer);
 
 	GLuint vert = compile_shader(renderer, GL_VERTEX_SHADER, vert_src);
@@ -767,6 +782,8 @@ static GLuint link_program(struct wlr_gles2_renderer *renderer,
 	}
 
 	pop_gles2_debug(renderer);
+
+	gles2_program_cache_store(renderer, prog, vert_src, frag_src);
 	return prog;
 
 error:
@@ -774,6 +791,22 @@ error:
 	return 0;
 }
 
+static bool init_shader(struct wlr_gles2_renderer *renderer,
+		struct wlr_gles2_shader *shader, const GLchar *frag_src) {
+	GLuint prog = link_program(renderer, common_vert_src, frag_src);
+	if (!prog) {
+		return false;
+	}
+
+	shader->program = prog;
+	shader->proj = glGetUniformLocation(prog, "proj");
+	shader->tex = glGetUniformLocation(prog, "tex");
+	shader->pos_attrib = glGetAttribLocation(prog, "pos");
+	shader->texcoord_attrib = glGetAttribLocation(prog, "texcoord");
+	shader->color_attrib = glGetAttribLocation(prog, "color");
+	return true;
+}
+
 static bool check_gl_ext(const char *exts, const char *ext) {
 	size_t extlen = strlen(ext);
 	const char *end = exts + strlen(exts);
@@ -837,10 +870,12 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 
 	wl_list_init(&renderer->buffers);
 	wl_list_init(&renderer->textures);
+	wl_list_init(&renderer->atlas_pages);
 
 	renderer->egl = egl;
 	renderer->exts_str = exts_str;
 	renderer->drm_fd = -1;
+	renderer->atlas_enabled = env_parse_bool("WLR_GLES2_ATLAS");
 
 	wlr_log(WLR_INFO, "Creating GLES2 renderer");
 	wlr_log(WLR_INFO, "Using %s", glGetString(GL_VERSION));
@@ -919,6 +954,22 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 		}
 	}
 
+	if (check_gl_ext(exts_str, "GL_NV_pixel_buffer_object") &&
+			check_gl_ext(exts_str, "GL_EXT_map_buffer_range") &&
+			check_gl_ext(exts_str, "GL_OES_mapbuffer") &&
+			!env_parse_bool("WLR_GLES2_NO_PBO")) {
+		renderer->exts.pbo = true;
+		load_gl_proc(&renderer->procs.glMapBufferRangeEXT, "glMapBufferRangeEXT");
+		load_gl_proc(&renderer->procs.glUnmapBufferOES, "glUnmapBufferOES");
+	}
+
+	if (check_gl_ext(exts_str, "GL_OES_get_program_binary") &&
+			!env_parse_bool("WLR_GLES2_NO_SHADER_CACHE")) {
+		renderer->exts.OES_get_program_binary = true;
+		load_gl_proc(&renderer->procs.glGetProgramBinaryOES, "glGetProgramBinaryOES");
+		load_gl_proc(&renderer->procs.glProgramBinaryOES, "glProgramBinaryOES");
+	}
+
 	if (renderer->exts.KHR_debug) {
 		glEnable(GL_DEBUG_OUTPUT_KHR);
 		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS_KHR);
@@ -933,51 +984,36 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 
 	push_gles2_debug(renderer);
 
-	GLuint prog;
-	renderer->shaders.quad.program = prog =
-		link_program(renderer, common_vert_src, quad_frag_src);
-	if (!renderer->shaders.quad.program) {
-		goto error;
+	struct timespec shaders_start, shaders_end;
+	clock_gettime(CLOCK_MONOTONIC, &shaders_start);
+
+	if (renderer->exts.OES_get_program_binary) {
+		gles2_program_cache_init(renderer);
 	}
-	renderer->shaders.quad.proj = glGetUniformLocation(prog, "proj");
-	renderer->shaders.quad.color = glGetUniformLocation(prog, "color");
-	renderer->shaders.quad.pos_attrib = glGetAttribLocation(prog, "pos");
 
-	renderer->shaders.tex_rgba.program = prog =
-		link_program(renderer, common_vert_src, tex_rgba_frag_src);
-	if (!renderer->shaders.tex_rgba.program) {
+	if (!init_shader(renderer, &renderer->shaders.quad, quad_frag_src)) {
 		goto error;
 	}
-	renderer->shaders.tex_rgba.proj = glGetUniformLocation(prog, "proj");
-	renderer->shaders.tex_rgba.tex_proj = glGetUniformLocation(prog, "tex_proj");
-	renderer->shaders.tex_rgba.tex = glGetUniformLocation(prog, "tex");
-	renderer->shaders.tex_rgba.alpha = glGetUniformLocation(prog, "alpha");
-	renderer->shaders.tex_rgba.pos_attrib = glGetAttribLocation(prog, "pos");
-
-	renderer->shaders.tex_rgbx.program = prog =
-		link_program(renderer, common_vert_src, tex_rgbx_frag_src);
-	if (!renderer->shaders.tex_rgbx.program) {
+	if (!init_shader(renderer, &renderer->shaders.tex_rgba, tex_rgba_frag_src)) {
 		goto error;
 	}
-	renderer->shaders.tex_rgbx.proj = glGetUniformLocation(prog, "proj");
-	renderer->shaders.tex_rgbx.tex_proj = glGetUniformLocation(prog, "tex_proj");
-	renderer->shaders.tex_rgbx.tex = glGetUniformLocation(prog, "tex");
-	renderer->shaders.tex_rgbx.alpha = glGetUniformLocation(prog, "alpha");
-	renderer->shaders.tex_rgbx.pos_attrib = glGetAttribLocation(prog, "pos");
-
-	if (renderer->exts.OES_egl_image_external) {
-		renderer->shaders.tex_ext.program = prog =
-			link_program(renderer, common_vert_src, tex_external_frag_src);
-		if (!renderer->shaders.tex_ext.program) {
-			goto error;
-		}
-		renderer->shaders.tex_ext.proj = glGetUniformLocation(prog, "proj");
-		renderer->shaders.tex_ext.tex_proj = glGetUniformLocation(prog, "tex_proj");
-		renderer->shaders.tex_ext.tex = glGetUniformLocation(prog, "tex");
-		renderer->shaders.tex_ext.alpha = glGetUniformLocation(prog, "alpha");
-		renderer->shaders.tex_ext.pos_attrib = glGetAttribLocation(prog, "pos");
+	if (!init_shader(renderer, &renderer->shaders.tex_rgbx, tex_rgbx_frag_src)) {
+		goto error;
+	}
+	if (renderer->exts.OES_egl_image_external &&
+			!init_shader(renderer, &renderer->shaders.tex_ext, tex_external_frag_src)) {
+		goto error;
 	}
 
+	// All programs are linked at startup, the cache isn't needed anymore
+	gles2_program_cache_finish(renderer);
+
+	clock_gettime(CLOCK_MONOTONIC, &shaders_end);
+	struct timespec shaders_duration;
+	timespec_sub(&shaders_duration, &shaders_end, &shaders_start);
+	wlr_log(WLR_INFO, "Shaders ready in %.2f ms, %zu program(s) loaded from cache",
+		timespec_to_nsec(&shaders_duration) / 1e6, renderer->program_cache.loaded);
+
 	pop_gles2_debug(renderer);
 
 	wlr_egl_unset_current(renderer->egl);
@@ -985,6 +1021,8 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 	return &renderer->wlr_renderer;
 
 error:
+	gles2_program_cache_finish(renderer);
+
 	glDeleteProgram(renderer->shaders.quad.program);
 	glDeleteProgram(renderer->shaders.tex_rgba.program);
 	glDeleteProgram(renderer->shaders.tex_rgbx.program);
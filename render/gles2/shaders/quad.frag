@@ -5,9 +5,7 @@ precision mediump float;
 #endif
 
 varying vec4 v_color;
-varying vec2 v_texcoord;
-uniform vec4 color;
 
 void main() {
-	gl_FragColor = color;
+	gl_FragColor = v_color;
 }
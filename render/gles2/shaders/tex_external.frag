@@ -7,9 +7,9 @@ precision mediump float;
 #endif
 
 varying vec2 v_texcoord;
+varying vec4 v_color;
 uniform samplerExternalOES tex;
-uniform float alpha;
 
 void main() {
-	gl_FragColor = texture2D(tex, v_texcoord) * alpha;
+	gl_FragColor = texture2D(tex, v_texcoord) * v_color.a;
 }
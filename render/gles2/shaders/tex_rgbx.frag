@@ -5,9 +5,9 @@ precision mediump float;
 #endif
 
 varying vec2 v_texcoord;
+varying vec4 v_color;
 uniform sampler2D tex;
-uniform float alpha;
 
 void main() {
-	gl_FragColor = vec4(texture2D(tex, v_texcoord).rgb, 1.0) * alpha;
+	gl_FragColor = vec4(texture2D(tex, v_texcoord).rgb, 1.0) * v_color.a;
 }
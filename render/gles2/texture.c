@@ -4,6 +4,7 @@
 #include <GLES2/gl2ext.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wayland-server-protocol.h>
 #include <wayland-util.h>
 #include <wlr/render/egl.h>
@@ -29,6 +30,141 @@ struct wlr_gles2_texture *gles2_get_texture(
 	return texture;
 }
 
+// Larger updates are uploaded directly, instead of growing the PBO ring
+#define MAX_PBO_SIZE (64 * 1024 * 1024)
+
+/**
+ * Upload damaged rectangles from client memory to the bound texture. The GL
+ * implementation needs to consume the data before returning, which may
+ * involve waiting for the GPU to be done with the texture.
+ */
+static void upload_rects(const struct wlr_gles2_pixel_format *fmt,
+		uint32_t bytes_per_pixel, const pixman_region32_t *damage,
+		const void *data, size_t stride) {
+	int rects_len = 0;
+	const pixman_box32_t *rects = pixman_region32_rectangles(damage, &rects_len);
+
+	for (int i = 0; i < rects_len; i++) {
+		pixman_box32_t rect = rects[i];
+
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, stride / bytes_per_pixel);
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, rect.x1);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, rect.y1);
+
+		int width = rect.x2 - rect.x1;
+		int height = rect.y2 - rect.y1;
+		glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x1, rect.y1, width, height,
+			fmt->gl_format, fmt->gl_type, data);
+	}
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+}
+
+/**
+ * Upload damaged rectangles to the bound texture through the renderer's
+ * pixel buffer object. The rectangles are packed into the PBO, after which
+ * the transfer to the texture is queued like any other GL command, without
+ * waiting for the GPU.
+ *
+ * The PBO is used as a ring, mapped without synchronization: the storage is
+ * orphaned when the ring wraps around, so that data still being transferred
+ * is never overwritten.
+ *
+ * The copy into the PBO happens on the calling thread: the mapping must be
+ * released with glUnmapBufferOES() before the transfer is queued, and both
+ * need the renderer's EGL context, which is current on this thread only.
+ * Handing the copy to another thread would just mean waiting for it here.
+ */
+static bool upload_rects_pbo(struct wlr_gles2_renderer *renderer,
+		const struct wlr_gles2_pixel_format *fmt, uint32_t bytes_per_pixel,
+		const pixman_region32_t *damage, const void *data, size_t stride) {
+	if (!renderer->exts.pbo) {
+		return false;
+	}
+
+	int rects_len = 0;
+	const pixman_box32_t *rects = pixman_region32_rectangles(damage, &rects_len);
+
+	size_t size = 0;
+	for (int i = 0; i < rects_len; i++) {
+		size += (size_t)(rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1) * bytes_per_pixel;
+	}
+	if (size == 0 || size > MAX_PBO_SIZE) {
+		return false;
+	}
+
+	if (renderer->pbo == 0) {
+		glGenBuffers(1, &renderer->pbo);
+		if (renderer->pbo == 0) {
+			return false;
+		}
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, renderer->pbo);
+	if (size > renderer->pbo_size) {
+		size_t pbo_size = renderer->pbo_size * 2;
+		if (pbo_size < size) {
+			pbo_size = size;
+		}
+		glBufferData(GL_PIXEL_UNPACK_BUFFER_NV, pbo_size, NULL, GL_STREAM_DRAW);
+		renderer->pbo_size = pbo_size;
+		renderer->pbo_offset = 0;
+	} else if (renderer->pbo_offset + size > renderer->pbo_size) {
+		glBufferData(GL_PIXEL_UNPACK_BUFFER_NV, renderer->pbo_size, NULL,
+			GL_STREAM_DRAW);
+		renderer->pbo_offset = 0;
+	}
+
+	size_t offset = renderer->pbo_offset;
+	unsigned char *map = renderer->procs.glMapBufferRangeEXT(
+		GL_PIXEL_UNPACK_BUFFER_NV, offset, size,
+		GL_MAP_WRITE_BIT_EXT | GL_MAP_INVALIDATE_RANGE_BIT_EXT |
+		GL_MAP_UNSYNCHRONIZED_BIT_EXT);
+	if (map == NULL) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+		return false;
+	}
+
+	unsigned char *dst = map;
+	for (int i = 0; i < rects_len; i++) {
+		pixman_box32_t rect = rects[i];
+		size_t row_size = (size_t)(rect.x2 - rect.x1) * bytes_per_pixel;
+		const unsigned char *src = (const unsigned char *)data +
+			(size_t)rect.y1 * stride + (size_t)rect.x1 * bytes_per_pixel;
+		for (int y = rect.y1; y < rect.y2; y++) {
+			memcpy(dst, src, row_size);
+			dst += row_size;
+			src += stride;
+		}
+	}
+
+	if (!renderer->procs.glUnmapBufferOES(GL_PIXEL_UNPACK_BUFFER_NV)) {
+		// The storage was lost, the ring is re-allocated on next use
+		renderer->pbo_size = 0;
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+		return false;
+	}
+	renderer->pbo_offset += size;
+
+	// Rows are tightly packed
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (int i = 0; i < rects_len; i++) {
+		pixman_box32_t rect = rects[i];
+		int width = rect.x2 - rect.x1;
+		int height = rect.y2 - rect.y1;
+		glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x1, rect.y1, width, height,
+			fmt->gl_format, fmt->gl_type, (const void *)(uintptr_t)offset);
+		offset += (size_t)width * height * bytes_per_pixel;
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+	return true;
+}
+
 static bool gles2_texture_update_from_buffer(struct wlr_texture *wlr_texture,
 		struct wlr_buffer *buffer, const pixman_region32_t *damage) {
 	struct wlr_gles2_texture *texture = gles2_get_texture(wlr_texture);
@@ -76,26 +212,14 @@ static bool gles2_texture_update_from_buffer(struct wlr_texture *wlr_texture,
 
 	glBindTexture(GL_TEXTURE_2D, texture->tex);
 
-	int rects_len = 0;
-	const pixman_box32_t *rects = pixman_region32_rectangles(damage, &rects_len);
-
-	for (int i = 0; i < rects_len; i++) {
-		pixman_box32_t rect = rects[i];
-
-		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, stride / drm_fmt->bytes_per_block);
-		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, rect.x1);
-		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, rect.y1);
-
-		int width = rect.x2 - rect.x1;
-		int height = rect.y2 - rect.y1;
-		glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x1, rect.y1, width, height,
-			fmt->gl_format, fmt->gl_type, data);
+	if (texture->atlas != NULL) {
+		gles2_atlas_upload(texture, fmt, drm_fmt->bytes_per_block,
+			damage, data, stride);
+	} else if (!upload_rects_pbo(texture->renderer, fmt,
+			drm_fmt->bytes_per_block, damage, data, stride)) {
+		upload_rects(fmt, drm_fmt->bytes_per_block, damage, data, stride);
 	}
 
-	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
-	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
-	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
-
 	glBindTexture(GL_TEXTURE_2D, 0);
 
 	pop_gles2_debug(texture->renderer);
@@ -146,7 +270,11 @@ void gles2_texture_destroy(struct wlr_gles2_texture *texture) {
 
 	push_gles2_debug(texture->renderer);
 
-	glDeleteTextures(1, &texture->tex);
+	if (texture->atlas != NULL) {
+		gles2_atlas_remove_texture(texture);
+	} else {
+		glDeleteTextures(1, &texture->tex);
+	}
 	wlr_egl_destroy_image(texture->renderer->egl, texture->image);
 
 	pop_gles2_debug(texture->renderer);
@@ -231,6 +359,20 @@ static struct wlr_texture *gles2_texture_from_pixels(
 
 	push_gles2_debug(renderer);
 
+	if (gles2_atlas_add_texture(renderer, texture, fmt)) {
+		pixman_region32_t region;
+		pixman_region32_init_rect(&region, 0, 0, width, height);
+		glBindTexture(GL_TEXTURE_2D, texture->tex);
+		gles2_atlas_upload(texture, fmt, drm_fmt->bytes_per_block,
+			&region, data, stride);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		pixman_region32_fini(&region);
+
+		pop_gles2_debug(renderer);
+		wlr_egl_restore_context(&prev_ctx);
+		return &texture->wlr_texture;
+	}
+
 	glGenTextures(1, &texture->tex);
 	glBindTexture(GL_TEXTURE_2D, texture->tex);
 
@@ -377,5 +519,28 @@ void wlr_gles2_texture_get_attribs(struct wlr_texture *wlr_texture,
 		.target = texture->target,
 		.tex = texture->tex,
 		.has_alpha = texture->has_alpha,
+		.box = {
+			.width = wlr_texture->width,
+			.height = wlr_texture->height,
+		},
 	};
+	if (texture->atlas != NULL) {
+		attribs->box = texture->atlas_box;
+	}
+}
+
+void gles2_texture_normalize_box(const struct wlr_gles2_texture *texture,
+		struct wlr_fbox *box) {
+	double width = texture->wlr_texture.width;
+	double height = texture->wlr_texture.height;
+	if (texture->atlas != NULL) {
+		box->x += texture->atlas_box.x;
+		box->y += texture->atlas_box.y;
+		width = height = GLES2_ATLAS_PAGE_SIZE;
+	}
+
+	box->x /= width;
+	box->y /= height;
+	box->width /= width;
+	box->height /= height;
 }
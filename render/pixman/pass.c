@@ -1,6 +1,11 @@
 #include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <wlr/util/log.h>
 #include "render/pixman.h"
+#include "util/worker_pool.h"
 
 static const struct wlr_render_pass_impl render_pass_impl;
 
@@ -16,16 +21,433 @@ static struct wlr_pixman_texture *get_texture(struct wlr_texture *wlr_texture) {
 	return texture;
 }
 
+// Tiles are a few times smaller than the share of each thread, so that
+// threads compositing cheap areas can pick up more work
+#define TILES_PER_THREAD 2
+#define MIN_TILE_HEIGHT 32
+
+struct wlr_pixman_render_op {
+	pixman_op_t op;
+	pixman_image_t *src;
+	pixman_image_t *mask; // may be NULL
+	int32_t src_x, src_y;
+	struct wlr_box dst_box;
+	bool clipped;
+	pixman_region32_t clip; // only valid if clipped
+	// Whether the operation is a plain copy of src pixels, in the same
+	// format as the render buffer
+	bool blit;
+
+	// Describe src and mask, so that each tile can get its own copies
+	bool solid; // src is a solid fill of color
+	struct pixman_color color;
+	bool transformed; // src has transform and filter set
+	struct pixman_transform transform;
+	pixman_filter_t filter;
+	uint16_t mask_alpha; // only valid if mask is set
+};
+
+struct render_tiles_job {
+	struct wlr_pixman_render_pass *pass;
+	int tile_height;
+	size_t tiles_len, ops_len;
+	// Images only used by one tile: its destination image aliasing the
+	// render buffer, and copies of the src and mask images of each operation
+	// drawn in the tile. pixman lazily computes the internal state of images
+	// when they're first composited, which isn't safe to do concurrently
+	// from several threads. With a single tile, the operation images are
+	// used directly and images_len is zero.
+	pixman_image_t **dsts; // tiles_len entries
+	pixman_image_t **images; // tiles_len * ops_len * 2 entries
+	size_t images_len;
+};
+
+static void blit_region(pixman_image_t *dst,
+		const struct wlr_pixman_render_op *op, const pixman_region32_t *region) {
+	int bpp = PIXMAN_FORMAT_BPP(pixman_image_get_format(dst)) / 8;
+	uint8_t *dst_data = (uint8_t *)pixman_image_get_data(dst);
+	int dst_stride = pixman_image_get_stride(dst);
+	const uint8_t *src_data = (const uint8_t *)pixman_image_get_data(op->src);
+	int src_stride = pixman_image_get_stride(op->src);
+	int dx = op->src_x - op->dst_box.x;
+	int dy = op->src_y - op->dst_box.y;
+
+	int rects_len;
+	const pixman_box32_t *rects = pixman_region32_rectangles(region, &rects_len);
+	for (int i = 0; i < rects_len; i++) {
+		const pixman_box32_t *rect = &rects[i];
+		size_t len = (size_t)(rect->x2 - rect->x1) * bpp;
+		for (int y = rect->y1; y < rect->y2; y++) {
+			memcpy(dst_data + (ptrdiff_t)y * dst_stride + rect->x1 * bpp,
+				src_data + (ptrdiff_t)(y + dy) * src_stride + (rect->x1 + dx) * bpp,
+				len);
+		}
+	}
+}
+
+static void get_tile_range(const struct render_tiles_job *job, size_t index,
+		int *y1, int *y2) {
+	int height = pixman_image_get_height(job->pass->buffer->image);
+	*y1 = index * job->tile_height;
+	*y2 = *y1 + job->tile_height;
+	if (*y2 > height) {
+		*y2 = height;
+	}
+}
+
+static bool op_in_tile(const struct wlr_pixman_render_op *op, int y1, int y2) {
+	return op->dst_box.y < y2 && op->dst_box.y + op->dst_box.height > y1;
+}
+
+static pixman_image_t *op_copy_src(const struct wlr_pixman_render_op *op) {
+	if (op->solid) {
+		return pixman_image_create_solid_fill(&op->color);
+	}
+
+	pixman_image_t *src = pixman_image_create_bits_no_clear(
+		pixman_image_get_format(op->src),
+		pixman_image_get_width(op->src),
+		pixman_image_get_height(op->src),
+		pixman_image_get_data(op->src),
+		pixman_image_get_stride(op->src));
+	if (src != NULL && op->transformed) {
+		pixman_image_set_transform(src, &op->transform);
+		pixman_image_set_filter(src, op->filter, NULL, 0);
+	}
+	return src;
+}
+
+static void render_tiles_job_finish(struct render_tiles_job *job) {
+	for (size_t i = 0; i < job->images_len; i++) {
+		if (job->images[i] != NULL) {
+			pixman_image_unref(job->images[i]);
+		}
+	}
+	free(job->images);
+	for (size_t i = 0; job->dsts != NULL && i < job->tiles_len; i++) {
+		if (job->dsts[i] != NULL) {
+			pixman_image_unref(job->dsts[i]);
+		}
+	}
+	free(job->dsts);
+}
+
+/**
+ * Create the images of each tile on the calling thread, before the tiles are
+ * composited.
+ */
+static bool render_tiles_job_init(struct render_tiles_job *job) {
+	pixman_image_t *target = job->pass->buffer->image;
+
+	job->dsts = calloc(job->tiles_len, sizeof(*job->dsts));
+	if (job->dsts == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return false;
+	}
+	for (size_t i = 0; i < job->tiles_len; i++) {
+		job->dsts[i] = pixman_image_create_bits_no_clear(
+			pixman_image_get_format(target),
+			pixman_image_get_width(target),
+			pixman_image_get_height(target),
+			pixman_image_get_data(target),
+			pixman_image_get_stride(target));
+		if (job->dsts[i] == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create pixman tile image");
+			return false;
+		}
+	}
+
+	if (job->tiles_len == 1) {
+		return true;
+	}
+
+	job->images = calloc(job->tiles_len * job->ops_len * 2, sizeof(*job->images));
+	if (job->images == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return false;
+	}
+	job->images_len = job->tiles_len * job->ops_len * 2;
+
+	for (size_t i = 0; i < job->tiles_len; i++) {
+		int y1, y2;
+		get_tile_range(job, i, &y1, &y2);
+
+		pixman_image_t **images = &job->images[i * job->ops_len * 2];
+		struct wlr_pixman_render_op *op;
+		wl_array_for_each(op, &job->pass->ops) {
+			// Blits only read the pixels of src
+			if (op_in_tile(op, y1, y2) && !op->blit) {
+				images[0] = op_copy_src(op);
+				if (images[0] == NULL) {
+					wlr_log(WLR_ERROR, "Failed to create pixman tile image");
+					return false;
+				}
+				if (op->mask != NULL) {
+					images[1] = pixman_image_create_solid_fill(
+						&(struct pixman_color){ .alpha = op->mask_alpha });
+					if (images[1] == NULL) {
+						wlr_log(WLR_ERROR, "Failed to create pixman tile image");
+						return false;
+					}
+				}
+			}
+			images += 2;
+		}
+	}
+
+	return true;
+}
+
+static void render_tile(void *data, size_t index) {
+	struct render_tiles_job *job = data;
+	pixman_image_t *dst = job->dsts[index];
+	int width = pixman_image_get_width(dst);
+
+	int y1, y2;
+	get_tile_range(job, index, &y1, &y2);
+
+	pixman_image_t **images = NULL;
+	if (job->images_len > 0) {
+		images = &job->images[index * job->ops_len * 2];
+	}
+
+	pixman_region32_t tile, clip;
+	pixman_region32_init_rect(&tile, 0, y1, width, y2 - y1);
+	pixman_region32_init(&clip);
+
+	struct wlr_pixman_render_op *op;
+	size_t i = 0;
+	wl_array_for_each(op, &job->pass->ops) {
+		size_t op_index = i++;
+		if (!op_in_tile(op, y1, y2)) {
+			continue;
+		}
+
+		if (op->clipped) {
+			pixman_region32_intersect(&clip, &op->clip, &tile);
+		} else {
+			pixman_region32_copy(&clip, &tile);
+		}
+		if (!pixman_region32_not_empty(&clip)) {
+			continue;
+		}
+
+		if (op->blit) {
+			pixman_region32_intersect_rect(&clip, &clip,
+				op->dst_box.x, op->dst_box.y,
+				op->dst_box.width, op->dst_box.height);
+			blit_region(dst, op, &clip);
+			continue;
+		}
+
+		pixman_image_t *src = op->src, *mask = op->mask;
+		if (images != NULL) {
+			src = images[op_index * 2];
+			mask = images[op_index * 2 + 1];
+		}
+
+		pixman_image_set_clip_region32(dst, &clip);
+		pixman_image_composite32(op->op, src, mask, dst,
+			op->src_x, op->src_y, 0, 0, op->dst_box.x, op->dst_box.y,
+			op->dst_box.width, op->dst_box.height);
+	}
+
+	pixman_region32_fini(&clip);
+	pixman_region32_fini(&tile);
+}
+
+static bool render_ops(struct wlr_pixman_render_pass *pass) {
+	struct wlr_pixman_renderer *renderer = pass->buffer->renderer;
+	int height = pixman_image_get_height(pass->buffer->image);
+	if (pass->ops.size == 0 || height <= 0) {
+		return true;
+	}
+
+	size_t tiles_len = 1;
+	if (renderer->worker_pool != NULL) {
+		tiles_len = (renderer->worker_threads + 1) * TILES_PER_THREAD;
+		size_t max_tiles_len = (height + MIN_TILE_HEIGHT - 1) / MIN_TILE_HEIGHT;
+		if (tiles_len > max_tiles_len) {
+			tiles_len = max_tiles_len;
+		}
+	}
+
+	struct render_tiles_job job = {
+		.pass = pass,
+		.tile_height = (height + tiles_len - 1) / tiles_len,
+		.ops_len = pass->ops.size / sizeof(struct wlr_pixman_render_op),
+	};
+	job.tiles_len = (height + job.tile_height - 1) / job.tile_height;
+
+	bool ok = render_tiles_job_init(&job);
+	if (ok) {
+		worker_pool_run(renderer->worker_pool, job.tiles_len, render_tile, &job);
+	}
+	render_tiles_job_finish(&job);
+	return ok;
+}
+
 static bool render_pass_submit(struct wlr_render_pass *wlr_pass) {
 	struct wlr_pixman_render_pass *pass = get_render_pass(wlr_pass);
 
+	bool ok = render_ops(pass);
+
+	struct wlr_pixman_render_op *op;
+	wl_array_for_each(op, &pass->ops) {
+		pixman_image_unref(op->src);
+		if (op->mask != NULL) {
+			pixman_image_unref(op->mask);
+		}
+		if (op->clipped) {
+			pixman_region32_fini(&op->clip);
+		}
+	}
+	wl_array_release(&pass->ops);
+
+	struct wlr_pixman_pass_buffer *pass_buffer;
+	wl_array_for_each(pass_buffer, &pass->buffers) {
+		pixman_image_unref(pass_buffer->image);
+		wlr_buffer_end_data_ptr_access(pass_buffer->buffer);
+		wlr_buffer_unlock(pass_buffer->buffer);
+	}
+	wl_array_release(&pass->buffers);
+
 	wlr_buffer_end_data_ptr_access(pass->buffer->buffer);
 	wlr_buffer_unlock(pass->buffer->buffer);
 	free(pass);
 
+	return ok;
+}
+
+/**
+ * Point the image of a texture at the pixels of another image of the same
+ * buffer.
+ */
+static bool texture_share_image_data(struct wlr_pixman_texture *texture,
+		pixman_image_t *image) {
+	// Textures of wl_shm buffers have no image until first accessed
+	if (texture->image != NULL &&
+			pixman_image_get_data(texture->image) == pixman_image_get_data(image)) {
+		return true;
+	}
+
+	pixman_image_t *new_image = pixman_image_create_bits_no_clear(
+		pixman_image_get_format(image),
+		pixman_image_get_width(image),
+		pixman_image_get_height(image),
+		pixman_image_get_data(image),
+		pixman_image_get_stride(image));
+	if (new_image == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create pixman image");
+		return false;
+	}
+
+	if (texture->image != NULL) {
+		pixman_image_unref(texture->image);
+	}
+	texture->image = new_image;
 	return true;
 }
 
+/**
+ * Keep the data pointer of a texture buffer accessible until the pass is
+ * submitted. Textures may be used several times in a pass, but their buffer
+ * is only accessed once. For wl_shm buffers, this also means that the SIGBUS
+ * handler is installed once for the whole pass.
+ *
+ * Several textures may wrap the same buffer: all of them get their image
+ * updated to the pixels of the current access.
+ *
+ * The image of a texture may be missing or stale outside of this function,
+ * render passes must only use the returned image. Returns NULL on error.
+ */
+static pixman_image_t *pass_get_texture_image(struct wlr_pixman_render_pass *pass,
+		struct wlr_pixman_texture *texture) {
+	if (texture->buffer == NULL) {
+		return texture->image;
+	}
+
+	struct wlr_pixman_pass_buffer *pass_buffer;
+	wl_array_for_each(pass_buffer, &pass->buffers) {
+		if (pass_buffer->buffer == texture->buffer) {
+			if (!texture_share_image_data(texture, pass_buffer->image)) {
+				return NULL;
+			}
+			return texture->image;
+		}
+	}
+
+	pass_buffer = wl_array_add(&pass->buffers, sizeof(*pass_buffer));
+	if (pass_buffer == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	if (!begin_pixman_data_ptr_access(texture->buffer, &texture->image,
+			WLR_BUFFER_DATA_PTR_ACCESS_READ)) {
+		pass->buffers.size -= sizeof(*pass_buffer);
+		return NULL;
+	}
+	*pass_buffer = (struct wlr_pixman_pass_buffer){
+		.buffer = wlr_buffer_lock(texture->buffer),
+		.image = pixman_image_ref(texture->image),
+	};
+	return texture->image;
+}
+
+/**
+ * Record an operation, taking ownership of src and mask.
+ */
+static struct wlr_pixman_render_op *pass_add_op(struct wlr_pixman_render_pass *pass, pixman_op_t op,
+		pixman_image_t *src, pixman_image_t *mask, int32_t src_x, int32_t src_y,
+		const struct wlr_box *dst_box, const pixman_region32_t *clip) {
+	struct wlr_pixman_render_op *render_op =
+		wl_array_add(&pass->ops, sizeof(*render_op));
+	if (render_op == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		pixman_image_unref(src);
+		if (mask != NULL) {
+			pixman_image_unref(mask);
+		}
+		return NULL;
+	}
+
+	*render_op = (struct wlr_pixman_render_op){
+		.op = op,
+		.src = src,
+		.mask = mask,
+		.src_x = src_x,
+		.src_y = src_y,
+		.dst_box = *dst_box,
+		.clipped = clip != NULL,
+	};
+	if (clip != NULL) {
+		pixman_region32_init(&render_op->clip);
+		pixman_region32_copy(&render_op->clip, clip);
+	}
+
+	return render_op;
+}
+
+/**
+ * Check whether compositing a texture without transform, scaling nor mask
+ * amounts to copying its pixels.
+ */
+static bool can_blit(pixman_op_t op, pixman_image_t *src, pixman_image_t *dst,
+		const struct wlr_box *src_box) {
+	pixman_format_code_t format = pixman_image_get_format(src);
+	if (format != pixman_image_get_format(dst) ||
+			PIXMAN_FORMAT_BPP(format) % 8 != 0) {
+		return false;
+	}
+	if (op != PIXMAN_OP_SRC && PIXMAN_FORMAT_A(format) != 0) {
+		return false;
+	}
+	// pixman reads pixels outside of the source as transparent
+	return src_box->x >= 0 && src_box->y >= 0 &&
+		src_box->x + src_box->width <= pixman_image_get_width(src) &&
+		src_box->y + src_box->height <= pixman_image_get_height(src);
+}
+
 static pixman_op_t get_pixman_blending(enum wlr_render_blend_mode mode) {
 	switch (mode) {
 	case WLR_RENDER_BLEND_MODE_PREMULTIPLIED:
@@ -42,13 +464,25 @@ static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 	struct wlr_pixman_texture *texture = get_texture(options->texture);
 	struct wlr_pixman_buffer *buffer = pass->buffer;
 
-	if (texture->buffer != NULL && !begin_pixman_data_ptr_access(texture->buffer,
-			&texture->image, WLR_BUFFER_DATA_PTR_ACCESS_READ)) {
+	pixman_image_t *image = pass_get_texture_image(pass, texture);
+	if (image == NULL) {
+		return;
+	}
+
+	// Each operation gets its own image sharing the texture pixels, so that
+	// transforms and filters of different operations don't conflict
+	pixman_image_t *src = pixman_image_create_bits_no_clear(
+		pixman_image_get_format(image),
+		pixman_image_get_width(image),
+		pixman_image_get_height(image),
+		pixman_image_get_data(image),
+		pixman_image_get_stride(image));
+	if (src == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create pixman image");
 		return;
 	}
 
 	pixman_op_t op = get_pixman_blending(options->blend_mode);
-	pixman_image_set_clip_region32(buffer->image, (pixman_region32_t *)options->clip);
 
 	struct wlr_fbox src_fbox;
 	wlr_render_texture_options_get_src_box(options, &src_fbox);
@@ -65,9 +499,7 @@ static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 	pixman_image_t *mask = NULL;
 	float alpha = wlr_render_texture_options_get_alpha(options);
 	if (alpha != 1) {
-		mask = pixman_image_create_solid_fill(&(struct pixman_color){
-			.alpha = 0xFFFF * alpha,
-		});
+		mask = pixman_renderer_get_solid_mask(buffer->renderer, alpha);
 	}
 
 	// Rotate the source size into destination coordinates
@@ -155,53 +587,48 @@ static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 		pixman_transform_translate(&transform, NULL,
 			pixman_int_to_fixed(src_box.x), pixman_int_to_fixed(src_box.y));
 
-		pixman_image_set_transform(texture->image, &transform);
+		pixman_image_set_transform(src, &transform);
 
+		pixman_filter_t filter = PIXMAN_FILTER_NEAREST;
 		switch (options->filter_mode) {
 		case WLR_SCALE_FILTER_BILINEAR:
-			pixman_image_set_filter(texture->image, PIXMAN_FILTER_BILINEAR, NULL, 0);
+			filter = PIXMAN_FILTER_BILINEAR;
 			break;
 		case WLR_SCALE_FILTER_NEAREST:
-			pixman_image_set_filter(texture->image, PIXMAN_FILTER_NEAREST, NULL, 0);
+			filter = PIXMAN_FILTER_NEAREST;
 			break;
 		}
+		pixman_image_set_filter(src, filter, NULL, 0);
 
 		// Now composite the result onto the pass buffer.  We specify a source origin of 0,0
 		// because the x,y part of source crop is already done using the transform. The
 		// width,height part of source crop is done here by the width and height we pass:
 		// because of the scaling, cropping at the end by dst_box.{width,height} is
 		// equivalent to if we cropped at the start by src_box.{width,height}.
-		pixman_image_composite32(op, texture->image, mask, buffer->image,
-			0, 0, // source x,y
-			0, 0, // mask x,y
-			dst_box.x, dst_box.y, // dest x,y
-			dst_box.width, dst_box.height // composite width,height
-		);
-
-		pixman_image_set_transform(texture->image, NULL);
+		struct wlr_pixman_render_op *render_op = pass_add_op(pass, op,
+			src, mask, 0, 0, &dst_box, options->clip);
+		if (render_op != NULL) {
+			render_op->transformed = true;
+			render_op->transform = transform;
+			render_op->filter = filter;
+			render_op->mask_alpha = 0xFFFF * alpha;
+		}
 	} else {
 		// No transforms or crop needed, just a straight blit from the source
-		pixman_image_set_transform(texture->image, NULL);
-		pixman_image_composite32(op, texture->image, mask, buffer->image,
-			src_box.x, src_box.y, 0, 0, dst_box.x, dst_box.y,
-			src_box.width, src_box.height);
-	}
-
-	pixman_image_set_clip_region32(buffer->image, NULL);
-
-	if (texture->buffer != NULL) {
-		wlr_buffer_end_data_ptr_access(texture->buffer);
-	}
-
-	if (mask != NULL) {
-		pixman_image_unref(mask);
+		bool blit = mask == NULL &&
+			can_blit(op, src, buffer->image, &src_box);
+		struct wlr_pixman_render_op *render_op = pass_add_op(pass, op,
+			src, mask, src_box.x, src_box.y, &dst_box, options->clip);
+		if (render_op != NULL) {
+			render_op->blit = blit;
+			render_op->mask_alpha = 0xFFFF * alpha;
+		}
 	}
 }
 
 static void render_pass_add_rect(struct wlr_render_pass *wlr_pass,
 		const struct wlr_render_rect_options *options) {
 	struct wlr_pixman_render_pass *pass = get_render_pass(wlr_pass);
-	struct wlr_pixman_buffer *buffer = pass->buffer;
 	struct wlr_box box;
 	wlr_render_rect_options_get_box(options, pass->buffer->buffer, &box);
 
@@ -216,13 +643,17 @@ static void render_pass_add_rect(struct wlr_render_pass *wlr_pass,
 	};
 
 	pixman_image_t *fill = pixman_image_create_solid_fill(&color);
+	if (fill == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create pixman image");
+		return;
+	}
 
-	pixman_image_set_clip_region32(buffer->image, (pixman_region32_t *)options->clip);
-	pixman_image_composite32(op, fill, NULL, buffer->image,
-		0, 0, 0, 0, box.x, box.y, box.width, box.height);
-	pixman_image_set_clip_region32(buffer->image, NULL);
-
-	pixman_image_unref(fill);
+	struct wlr_pixman_render_op *render_op =
+		pass_add_op(pass, op, fill, NULL, 0, 0, &box, options->clip);
+	if (render_op != NULL) {
+		render_op->solid = true;
+		render_op->color = color;
+	}
 }
 
 static const struct wlr_render_pass_impl render_pass_impl = {
@@ -248,6 +679,8 @@ struct wlr_pixman_render_pass *begin_pixman_render_pass(
 
 	wlr_buffer_lock(buffer->buffer);
 	pass->buffer = buffer;
+	wl_array_init(&pass->ops);
+	wl_array_init(&pass->buffers);
 
 	return pass;
 }
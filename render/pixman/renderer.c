@@ -10,6 +10,7 @@
 
 #include "render/pixman.h"
 #include "types/wlr_buffer.h"
+#include "util/worker_pool.h"
 
 static const struct wlr_renderer_impl renderer_impl;
 
@@ -38,18 +39,21 @@ bool begin_pixman_data_ptr_access(struct wlr_buffer *wlr_buffer, pixman_image_t
 
 	// If the data pointer has changed, re-create the Pixman image. This can
 	// happen if it's a client buffer and the wl_shm_pool has been resized.
-	if (data != pixman_image_get_data(image)) {
+	// Textures created from wl_shm buffers have no image until first used.
+	if (image == NULL || data != pixman_image_get_data(image)) {
 		pixman_format_code_t format = get_pixman_format_from_drm(drm_format);
 		assert(format != 0);
 
 		pixman_image_t *new_image = pixman_image_create_bits_no_clear(format,
 			wlr_buffer->width, wlr_buffer->height, data, stride);
-		if (image == NULL) {
+		if (new_image == NULL) {
 			wlr_buffer_end_data_ptr_access(wlr_buffer);
 			return false;
 		}
 
-		pixman_image_unref(image);
+		if (image != NULL) {
+			pixman_image_unref(image);
+		}
 		image = new_image;
 	}
 
@@ -84,7 +88,9 @@ static struct wlr_pixman_texture *get_texture(
 static void texture_destroy(struct wlr_texture *wlr_texture) {
 	struct wlr_pixman_texture *texture = get_texture(wlr_texture);
 	wl_list_remove(&texture->link);
-	pixman_image_unref(texture->image);
+	if (texture->image != NULL) {
+		pixman_image_unref(texture->image);
+	}
 	wlr_buffer_unlock(texture->buffer);
 	free(texture->data);
 	free(texture);
@@ -247,9 +253,7 @@ static bool pixman_render_subtexture_with_matrix(
 
 	pixman_image_t *mask = NULL;
 	if (alpha != 1.0) {
-		struct pixman_color mask_colour = {0};
-		mask_colour.alpha = 0xFFFF * alpha;
-		mask = pixman_image_create_solid_fill(&mask_colour);
+		mask = pixman_renderer_get_solid_mask(renderer, alpha);
 	}
 
 	float m[9];
@@ -374,14 +378,22 @@ static struct wlr_texture *pixman_texture_from_buffer(
 		struct wlr_renderer *wlr_renderer, struct wlr_buffer *buffer) {
 	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
 
+	// Accessing the data pointer of wl_shm buffers installs a SIGBUS handler,
+	// so only do it when the texture is rendered: render passes access each
+	// buffer once for the whole pass.
 	void *data = NULL;
 	uint32_t drm_format;
 	size_t stride;
-	if (!wlr_buffer_begin_data_ptr_access(buffer, WLR_BUFFER_DATA_PTR_ACCESS_READ,
-			&data, &drm_format, &stride)) {
-		return NULL;
+	struct wlr_shm_attributes shm;
+	if (wlr_buffer_get_shm(buffer, &shm)) {
+		drm_format = shm.format;
+	} else {
+		if (!wlr_buffer_begin_data_ptr_access(buffer, WLR_BUFFER_DATA_PTR_ACCESS_READ,
+				&data, &drm_format, &stride)) {
+			return NULL;
+		}
+		wlr_buffer_end_data_ptr_access(buffer);
 	}
-	wlr_buffer_end_data_ptr_access(buffer);
 
 	struct wlr_pixman_texture *texture = pixman_texture_create(renderer,
 		drm_format, buffer->width, buffer->height);
@@ -389,13 +401,15 @@ static struct wlr_texture *pixman_texture_from_buffer(
 		return NULL;
 	}
 
-	texture->image = pixman_image_create_bits_no_clear(texture->format,
-		buffer->width, buffer->height, data, stride);
-	if (!texture->image) {
-		wlr_log(WLR_ERROR, "Failed to create pixman image");
-		wl_list_remove(&texture->link);
-		free(texture);
-		return NULL;
+	if (data != NULL) {
+		texture->image = pixman_image_create_bits_no_clear(texture->format,
+			buffer->width, buffer->height, data, stride);
+		if (!texture->image) {
+			wlr_log(WLR_ERROR, "Failed to create pixman image");
+			wl_list_remove(&texture->link);
+			free(texture);
+			return NULL;
+		}
 	}
 
 	texture->buffer = wlr_buffer_lock(buffer);
@@ -443,11 +457,39 @@ static void pixman_destroy(struct wlr_renderer *wlr_renderer) {
 		wlr_texture_destroy(&tex->wlr_texture);
 	}
 
+	for (size_t i = 0; i < WLR_PIXMAN_MASK_CACHE_SIZE; i++) {
+		if (renderer->masks[i].image != NULL) {
+			pixman_image_unref(renderer->masks[i].image);
+		}
+	}
+
 	wlr_drm_format_set_finish(&renderer->drm_formats);
+	worker_pool_destroy(renderer->worker_pool);
 
 	free(renderer);
 }
 
+pixman_image_t *pixman_renderer_get_solid_mask(
+		struct wlr_pixman_renderer *renderer, float alpha) {
+	uint16_t value = 0xFFFF * alpha;
+	struct wlr_pixman_solid_mask *mask =
+		&renderer->masks[value % WLR_PIXMAN_MASK_CACHE_SIZE];
+	if (mask->image == NULL || mask->alpha != value) {
+		pixman_image_t *image = pixman_image_create_solid_fill(&(struct pixman_color){
+			.alpha = value,
+		});
+		if (image == NULL) {
+			return NULL;
+		}
+		if (mask->image != NULL) {
+			pixman_image_unref(mask->image);
+		}
+		mask->image = image;
+		mask->alpha = value;
+	}
+	return pixman_image_ref(mask->image);
+}
+
 static uint32_t pixman_preferred_read_format(
 		struct wlr_renderer *wlr_renderer) {
 	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
@@ -536,6 +578,9 @@ struct wlr_renderer *wlr_pixman_renderer_create(void) {
 
 	wlr_log(WLR_INFO, "Creating pixman renderer");
 	wlr_renderer_init(&renderer->wlr_renderer, &renderer_impl);
+	// Each pixel is composited on the CPU, while a rectangle is little more
+	// than a loop setup, so only merge damage which is really close
+	renderer->wlr_renderer.damage_rect_cost = 1024;
 	wl_list_init(&renderer->buffers);
 	wl_list_init(&renderer->textures);
 
@@ -552,8 +597,30 @@ struct wlr_renderer *wlr_pixman_renderer_create(void) {
 	return &renderer->wlr_renderer;
 }
 
+bool wlr_pixman_renderer_set_worker_threads(struct wlr_renderer *wlr_renderer,
+		size_t threads) {
+	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
+
+	struct worker_pool *pool = NULL;
+	if (threads > 0) {
+		pool = worker_pool_create(threads);
+		if (pool == NULL) {
+			return false;
+		}
+	}
+
+	worker_pool_destroy(renderer->worker_pool);
+	renderer->worker_pool = pool;
+	renderer->worker_threads = threads;
+	return true;
+}
+
 pixman_image_t *wlr_pixman_texture_get_image(struct wlr_texture *wlr_texture) {
 	struct wlr_pixman_texture *texture = get_texture(wlr_texture);
+	if (texture->image == NULL && begin_pixman_data_ptr_access(texture->buffer,
+			&texture->image, WLR_BUFFER_DATA_PTR_ACCESS_READ)) {
+		wlr_buffer_end_data_ptr_access(texture->buffer);
+	}
 	return texture->image;
 }
 
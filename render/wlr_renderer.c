@@ -7,6 +7,7 @@
 #include <wlr/render/interface.h>
 #include <wlr/render/pixman.h>
 #include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_damage_ring.h>
 #include <wlr/types/wlr_drm.h>
 #include <wlr/types/wlr_linux_dmabuf_v1.h>
 #include <wlr/types/wlr_matrix.h>
@@ -47,6 +48,7 @@ void wlr_renderer_init(struct wlr_renderer *renderer,
 
 	*renderer = (struct wlr_renderer){
 		.impl = impl,
+		.damage_rect_cost = WLR_DAMAGE_RING_DEFAULT_RECT_COST,
 	};
 
 	wl_signal_init(&renderer->events.destroy);
@@ -1,14 +1,17 @@
 #define _POSIX_C_SOURCE 200809L
 #include <assert.h>
+#include <drm_fourcc.h>
 #include <stdlib.h>
 #include <string.h>
 #include <wlr/backend.h>
+#include <wlr/render/allocator.h>
 #include <wlr/render/swapchain.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/types/wlr_compositor.h>
 #include <wlr/types/wlr_damage_ring.h>
 #include <wlr/types/wlr_matrix.h>
 #include <wlr/types/wlr_linux_dmabuf_v1.h>
+#include <wlr/types/wlr_output_layer.h>
 #include <wlr/types/wlr_presentation_time.h>
 #include <wlr/types/wlr_scene.h>
 #include <wlr/util/log.h>
@@ -18,9 +21,12 @@
 #include "types/wlr_scene.h"
 #include "util/array.h"
 #include "util/env.h"
+#include "util/rect_union.h"
+#include "util/tile_bitmap.h"
 #include "util/time.h"
 
 #define HIGHLIGHT_DAMAGE_FADEOUT_TIME 250
+#define SCENE_DAMAGE_RING_MAX_PREVIOUS_LEN 8
 
 struct wlr_scene_tree *wlr_scene_tree_from_node(struct wlr_scene_node *node) {
 	assert(node->type == WLR_SCENE_NODE_TREE);
@@ -56,6 +62,67 @@ struct wlr_scene *scene_node_get_root(struct wlr_scene_node *node) {
 	return scene;
 }
 
+/**
+ * Maximum number of freed nodes of each type kept around for reuse.
+ * Short-lived nodes such as popups and tooltips get created and destroyed
+ * at a high rate, this avoids going through the allocator each time.
+ */
+#define SCENE_NODE_CACHE_MAX 256
+
+static const size_t scene_node_sizes[] = {
+	[WLR_SCENE_NODE_TREE] = sizeof(struct wlr_scene_tree),
+	[WLR_SCENE_NODE_RECT] = sizeof(struct wlr_scene_rect),
+	[WLR_SCENE_NODE_BUFFER] = sizeof(struct wlr_scene_buffer),
+};
+
+static void *scene_node_alloc(struct wlr_scene_tree *parent,
+		enum wlr_scene_node_type type) {
+	struct wlr_scene *scene = scene_node_get_root(&parent->node);
+	struct wlr_scene_node_cache *cache = &scene->node_cache[type];
+
+	void *mem = cache->free;
+	if (mem == NULL) {
+		return calloc(1, scene_node_sizes[type]);
+	}
+
+	cache->free = *(void **)mem;
+	cache->len--;
+	memset(mem, 0, scene_node_sizes[type]);
+	return mem;
+}
+
+static void scene_node_cache_finish(struct wlr_scene *scene) {
+	for (size_t i = 0; i < sizeof(scene->node_cache) / sizeof(scene->node_cache[0]); i++) {
+		void *mem = scene->node_cache[i].free;
+		while (mem != NULL) {
+			void *next = *(void **)mem;
+			free(mem);
+			mem = next;
+		}
+		scene->node_cache[i] = (struct wlr_scene_node_cache){0};
+	}
+}
+
+static void scene_node_free(struct wlr_scene *scene, struct wlr_scene_node *node) {
+	if (node == &scene->tree.node) {
+		scene_node_cache_finish(scene);
+		free(scene);
+		return;
+	}
+
+	struct wlr_scene_node_cache *cache = &scene->node_cache[node->type];
+	if (cache->len >= SCENE_NODE_CACHE_MAX) {
+		free(node);
+		return;
+	}
+
+	// All node types start with a struct wlr_scene_node, which is larger
+	// than a pointer
+	*(void **)node = cache->free;
+	cache->free = node;
+	cache->len++;
+}
+
 static void scene_node_init(struct wlr_scene_node *node,
 		enum wlr_scene_node_type type, struct wlr_scene_tree *parent) {
 	*node = (struct wlr_scene_node){
@@ -68,6 +135,8 @@ static void scene_node_init(struct wlr_scene_node *node,
 
 	wl_signal_init(&node->events.destroy);
 	pixman_region32_init(&node->visible);
+	pixman_region32_init(&node->opaque);
+	node->opaque_dirty = true;
 
 	if (parent != NULL) {
 		wl_list_insert(parent->children.prev, &node->link);
@@ -82,6 +151,56 @@ struct highlight_region {
 	struct wl_list link;
 };
 
+// Caches kept per cached tree, for outputs with different scales
+#define MAX_TREE_CACHES 4
+
+static void tree_cache_release_buffer(struct wlr_scene_tree_cache *cache) {
+	wlr_texture_destroy(cache->texture);
+	wlr_buffer_drop(cache->buffer);
+	cache->texture = NULL;
+	cache->buffer = NULL;
+}
+
+static void scene_tree_release_cache(struct wlr_scene_tree *tree) {
+	struct wlr_scene_tree_cache *cache;
+	wl_array_for_each(cache, &tree->caches) {
+		tree_cache_release_buffer(cache);
+	}
+	wl_array_release(&tree->caches);
+	wl_array_init(&tree->caches);
+}
+
+/**
+ * Find the cache of a tree for the given renderer, scale and buffer size.
+ * Returns NULL if there is none.
+ */
+static struct wlr_scene_tree_cache *scene_tree_get_cache(
+		struct wlr_scene_tree *tree, struct wlr_renderer *renderer,
+		float scale, int width, int height) {
+	struct wlr_scene_tree_cache *cache;
+	wl_array_for_each(cache, &tree->caches) {
+		if (cache->renderer == renderer && cache->scale == scale &&
+				cache->buffer != NULL && cache->buffer->width == width &&
+				cache->buffer->height == height) {
+			return cache;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Mark the contents of all cached ancestors of this node as stale. Must be
+ * called whenever the node is about to be rendered differently.
+ */
+static void scene_node_invalidate_caches(struct wlr_scene_node *node) {
+	for (struct wlr_scene_tree *tree = node->parent; tree != NULL;
+			tree = tree->node.parent) {
+		if (tree->cached) {
+			tree->cache_generation++;
+		}
+	}
+}
+
 void wlr_scene_node_destroy(struct wlr_scene_node *node) {
 	if (node == NULL) {
 		return;
@@ -125,6 +244,7 @@ void wlr_scene_node_destroy(struct wlr_scene_node *node) {
 
 			wl_list_remove(&scene->presentation_destroy.link);
 			wl_list_remove(&scene->linux_dmabuf_v1_destroy.link);
+			pixman_region32_fini(&scene->node_at_cache.region);
 		} else {
 			assert(node->parent);
 		}
@@ -134,11 +254,15 @@ void wlr_scene_node_destroy(struct wlr_scene_node *node) {
 				&scene_tree->children, link) {
 			wlr_scene_node_destroy(child);
 		}
+
+		scene_tree_release_cache(scene_tree);
+		pixman_region32_fini(&scene_tree->cache_visible);
 	}
 
 	wl_list_remove(&node->link);
 	pixman_region32_fini(&node->visible);
-	free(node);
+	pixman_region32_fini(&node->opaque);
+	scene_node_free(scene, node);
 }
 
 static void scene_tree_init(struct wlr_scene_tree *tree,
@@ -146,6 +270,8 @@ static void scene_tree_init(struct wlr_scene_tree *tree,
 	*tree = (struct wlr_scene_tree){0};
 	scene_node_init(&tree->node, WLR_SCENE_NODE_TREE, parent);
 	wl_list_init(&tree->children);
+	wl_array_init(&tree->caches);
+	pixman_region32_init(&tree->cache_visible);
 }
 
 struct wlr_scene *wlr_scene_create(void) {
@@ -159,6 +285,7 @@ struct wlr_scene *wlr_scene_create(void) {
 	wl_list_init(&scene->outputs);
 	wl_list_init(&scene->presentation_destroy.link);
 	wl_list_init(&scene->linux_dmabuf_v1_destroy.link);
+	pixman_region32_init(&scene->node_at_cache.region);
 
 	const char *debug_damage_options[] = {
 		"none",
@@ -177,7 +304,7 @@ struct wlr_scene *wlr_scene_create(void) {
 struct wlr_scene_tree *wlr_scene_tree_create(struct wlr_scene_tree *parent) {
 	assert(parent);
 
-	struct wlr_scene_tree *tree = calloc(1, sizeof(*tree));
+	struct wlr_scene_tree *tree = scene_node_alloc(parent, WLR_SCENE_NODE_TREE);
 	if (tree == NULL) {
 		return NULL;
 	}
@@ -186,8 +313,89 @@ struct wlr_scene_tree *wlr_scene_tree_create(struct wlr_scene_tree *parent) {
 	return tree;
 }
 
+static void scene_node_update(struct wlr_scene_node *node,
+		pixman_region32_t *damage);
+
+void wlr_scene_tree_set_cached(struct wlr_scene_tree *tree, bool cached) {
+	if (tree->cached == cached) {
+		return;
+	}
+
+	tree->cached = cached;
+	scene_tree_release_cache(tree);
+	scene_node_update(&tree->node, NULL);
+}
+
 static void scene_node_get_size(struct wlr_scene_node *node, int *lx, int *ly);
 
+static void box_union(struct wlr_box *dest, const struct wlr_box *box) {
+	if (wlr_box_empty(box)) {
+		return;
+	}
+	if (wlr_box_empty(dest)) {
+		*dest = *box;
+		return;
+	}
+
+	int x1 = dest->x < box->x ? dest->x : box->x;
+	int y1 = dest->y < box->y ? dest->y : box->y;
+	int x2 = dest->x + dest->width > box->x + box->width ?
+		dest->x + dest->width : box->x + box->width;
+	int y2 = dest->y + dest->height > box->y + box->height ?
+		dest->y + dest->height : box->y + box->height;
+
+	*dest = (struct wlr_box){
+		.x = x1,
+		.y = y1,
+		.width = x2 - x1,
+		.height = y2 - y1,
+	};
+}
+
+/**
+ * Mark the cached bounds of all ancestors of this node as stale. Must be
+ * called whenever the node's geometry or its enabled state changes.
+ *
+ * A tree with dirty bounds always has dirty ancestors, so we can stop as
+ * soon as we encounter one.
+ */
+static void scene_node_invalidate_bounds(struct wlr_scene_node *node) {
+	struct wlr_scene_tree *tree = node->parent;
+	while (tree != NULL && !tree->bounds_dirty) {
+		tree->bounds_dirty = true;
+		tree = tree->node.parent;
+	}
+}
+
+static const struct wlr_box *scene_tree_get_bounds(struct wlr_scene_tree *tree) {
+	if (!tree->bounds_dirty) {
+		return &tree->bounds;
+	}
+
+	struct wlr_box bounds = {0};
+	struct wlr_scene_node *child;
+	wl_list_for_each(child, &tree->children, link) {
+		if (!child->enabled) {
+			continue;
+		}
+
+		struct wlr_box child_box;
+		if (child->type == WLR_SCENE_NODE_TREE) {
+			child_box = *scene_tree_get_bounds(wlr_scene_tree_from_node(child));
+		} else {
+			child_box = (struct wlr_box){0};
+			scene_node_get_size(child, &child_box.width, &child_box.height);
+		}
+		child_box.x += child->x;
+		child_box.y += child->y;
+		box_union(&bounds, &child_box);
+	}
+
+	tree->bounds = bounds;
+	tree->bounds_dirty = false;
+	return &tree->bounds;
+}
+
 typedef bool (*scene_node_box_iterator_func_t)(struct wlr_scene_node *node,
 	int sx, int sy, void *data);
 
@@ -200,6 +408,16 @@ static bool _scene_nodes_in_box(struct wlr_scene_node *node, struct wlr_box *box
 	switch (node->type) {
 	case WLR_SCENE_NODE_TREE:;
 		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
+
+		// Skip the whole sub-tree if none of its descendants can intersect
+		// the box
+		struct wlr_box bounds = *scene_tree_get_bounds(scene_tree);
+		bounds.x += lx;
+		bounds.y += ly;
+		if (!wlr_box_intersection(&bounds, &bounds, box)) {
+			break;
+		}
+
 		struct wlr_scene_node *child;
 		wl_list_for_each_reverse(child, &scene_tree->children, link) {
 			if (_scene_nodes_in_box(child, box, iterator, user_data, lx + child->x, ly + child->y)) {
@@ -230,11 +448,13 @@ static bool scene_nodes_in_box(struct wlr_scene_node *node, struct wlr_box *box,
 	return _scene_nodes_in_box(node, box, iterator, user_data, x, y);
 }
 
-static void scene_node_opaque_region(struct wlr_scene_node *node, int x, int y,
+static void scene_node_compute_opaque_region(struct wlr_scene_node *node,
 		pixman_region32_t *opaque) {
 	int width, height;
 	scene_node_get_size(node, &width, &height);
 
+	pixman_region32_clear(opaque);
+
 	if (node->type == WLR_SCENE_NODE_RECT) {
 		struct wlr_scene_rect *scene_rect = wlr_scene_rect_from_node(node);
 		if (scene_rect->color[3] != 1) {
@@ -252,15 +472,46 @@ static void scene_node_opaque_region(struct wlr_scene_node *node, int x, int y,
 		}
 
 		if (!buffer_is_opaque(scene_buffer->buffer)) {
-			pixman_region32_copy(opaque, &scene_buffer->opaque_region);
-			pixman_region32_intersect_rect(opaque, opaque, 0, 0, width, height);
-			pixman_region32_translate(opaque, x, y);
+			pixman_region32_intersect_rect(opaque, &scene_buffer->opaque_region,
+				0, 0, width, height);
 			return;
 		}
 	}
 
 	pixman_region32_fini(opaque);
-	pixman_region32_init_rect(opaque, x, y, width, height);
+	pixman_region32_init_rect(opaque, 0, 0, width, height);
+}
+
+/**
+ * Mark the cached opaque region of the node as stale. Must be called whenever
+ * a property affecting it changes: size, buffer, opacity, opaque region or
+ * rect color.
+ */
+static void scene_node_invalidate_opaque_region(struct wlr_scene_node *node) {
+	node->opaque_dirty = true;
+}
+
+/**
+ * Get the opaque region of the node, in layout coordinates with the node
+ * positioned at (x, y).
+ *
+ * The region is cached on the node. If the node moved since the last call, the
+ * cached region is translated in place instead of being recomputed.
+ */
+static const pixman_region32_t *scene_node_opaque_region(
+		struct wlr_scene_node *node, int x, int y) {
+	if (node->opaque_dirty) {
+		scene_node_compute_opaque_region(node, &node->opaque);
+		pixman_region32_translate(&node->opaque, x, y);
+		node->opaque_dirty = false;
+	} else if (node->opaque_x != x || node->opaque_y != y) {
+		pixman_region32_translate(&node->opaque,
+			x - node->opaque_x, y - node->opaque_y);
+	}
+
+	node->opaque_x = x;
+	node->opaque_y = y;
+	return &node->opaque;
 }
 
 struct scene_update_data {
@@ -300,6 +551,14 @@ struct render_data {
 
 	struct wlr_render_pass *render_pass;
 	pixman_region32_t damage;
+	// Tiles covering damage, see wlr_scene_set_damage_tile_size()
+	const struct tile_bitmap *damage_tiles; // may be NULL
+
+	struct wlr_scene_output_stats *stats; // may be NULL
+
+	// Rendering the contents of a cached tree: whole nodes are rendered
+	// regardless of their visibility, and no output is being sampled
+	bool cache_pass;
 };
 
 static void transform_output_damage(pixman_region32_t *damage, const struct render_data *data) {
@@ -312,7 +571,8 @@ static void transform_output_box(struct wlr_box *box, const struct render_data *
 	wlr_box_transform(box, box, transform, data->trans_width, data->trans_height);
 }
 
-static void scene_damage_outputs(struct wlr_scene *scene, pixman_region32_t *damage) {
+static void scene_damage_outputs(struct wlr_scene *scene,
+		const pixman_region32_t *damage) {
 	if (!pixman_region32_not_empty(damage)) {
 		return;
 	}
@@ -447,26 +707,63 @@ static bool scene_node_update_iterator(struct wlr_scene_node *node,
 	struct wlr_box box = { .x = lx, .y = ly };
 	scene_node_get_size(node, &box.width, &box.height);
 
-	pixman_region32_subtract(&node->visible, &node->visible, data->update_region);
-	pixman_region32_union(&node->visible, &node->visible, data->visible);
-	pixman_region32_intersect_rect(&node->visible, &node->visible,
+	// Once the update region is fully covered by opaque nodes, nodes below
+	// can only lose the parts of their visible region overlapping it. If
+	// there are none, the visible region is left untouched.
+	bool update_visible = pixman_region32_not_empty(data->visible);
+	if (!update_visible) {
+		if (!pixman_region32_not_empty(&node->visible)) {
+			return false;
+		}
+
+		pixman_box32_t *extents = pixman_region32_extents(&node->visible);
+		if (extents->x1 >= box.x && extents->y1 >= box.y &&
+				extents->x2 <= box.x + box.width &&
+				extents->y2 <= box.y + box.height &&
+				pixman_region32_contains_rectangle(data->update_region,
+					extents) == PIXMAN_REGION_OUT) {
+			return false;
+		}
+	}
+
+	pixman_region32_t visible;
+	pixman_region32_init(&visible);
+	pixman_region32_subtract(&visible, &node->visible, data->update_region);
+	pixman_region32_union(&visible, &visible, data->visible);
+	pixman_region32_intersect_rect(&visible, &visible,
 		lx, ly, box.width, box.height);
 
-	if (data->calculate_visibility) {
-		pixman_region32_t opaque;
-		pixman_region32_init(&opaque);
-		scene_node_opaque_region(node, lx, ly, &opaque);
-		pixman_region32_subtract(data->visible, data->visible, &opaque);
-		pixman_region32_fini(&opaque);
+	if (update_visible && data->calculate_visibility) {
+		pixman_region32_subtract(data->visible, data->visible,
+			scene_node_opaque_region(node, lx, ly));
 	}
 
-	update_node_update_outputs(node, data->outputs, NULL, NULL);
+	// Output enter/leave only depends on the visible region, so it only
+	// needs to be recomputed for nodes whose visible region changed
+	bool changed = !pixman_region32_equal(&visible, &node->visible);
+	if (changed) {
+		pixman_region32_copy(&node->visible, &visible);
+	}
+	pixman_region32_fini(&visible);
+
+	if (changed) {
+		update_node_update_outputs(node, data->outputs, NULL, NULL);
+	}
 
 	return false;
 }
 
-static void scene_node_visibility(struct wlr_scene_node *node,
-		pixman_region32_t *visible) {
+static void collect_region(struct rect_union *ru,
+		const pixman_region32_t *region) {
+	int nrects;
+	const pixman_box32_t *rects = pixman_region32_rectangles(region, &nrects);
+	for (int i = 0; i < nrects; i++) {
+		rect_union_add(ru, rects[i]);
+	}
+}
+
+static void scene_node_collect_visibility(struct wlr_scene_node *node,
+		struct rect_union *visible) {
 	if (!node->enabled) {
 		return;
 	}
@@ -475,16 +772,16 @@ static void scene_node_visibility(struct wlr_scene_node *node,
 		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
 		struct wlr_scene_node *child;
 		wl_list_for_each(child, &scene_tree->children, link) {
-			scene_node_visibility(child, visible);
+			scene_node_collect_visibility(child, visible);
 		}
 		return;
 	}
 
-	pixman_region32_union(visible, visible, &node->visible);
+	collect_region(visible, &node->visible);
 }
 
-static void scene_node_bounds(struct wlr_scene_node *node,
-		int x, int y, pixman_region32_t *visible) {
+static void scene_node_collect_bounds(struct wlr_scene_node *node,
+		int x, int y, struct rect_union *visible) {
 	if (!node->enabled) {
 		return;
 	}
@@ -493,18 +790,62 @@ static void scene_node_bounds(struct wlr_scene_node *node,
 		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
 		struct wlr_scene_node *child;
 		wl_list_for_each(child, &scene_tree->children, link) {
-			scene_node_bounds(child, x + child->x, y + child->y, visible);
+			scene_node_collect_bounds(child, x + child->x, y + child->y, visible);
 		}
 		return;
 	}
 
 	int width, height;
 	scene_node_get_size(node, &width, &height);
-	pixman_region32_union_rect(visible, visible, x, y, width, height);
+	rect_union_add(visible, (pixman_box32_t){
+		.x1 = x,
+		.y1 = y,
+		.x2 = x + width,
+		.y2 = y + height,
+	});
+}
+
+/**
+ * Add a rect_union to a region. The rectangles are merged in a single pass
+ * instead of one union per node.
+ */
+static void region_add_rect_union(pixman_region32_t *region,
+		struct rect_union *ru) {
+	if (ru->unsorted.size > 0 || ru->alloc_failure) {
+		pixman_region32_union(region, region, rect_union_evaluate(ru));
+	}
+	rect_union_finish(ru);
+}
+
+static void scene_node_visibility(struct wlr_scene_node *node,
+		pixman_region32_t *visible) {
+	struct rect_union ru;
+	rect_union_init(&ru);
+	scene_node_collect_visibility(node, &ru);
+	region_add_rect_union(visible, &ru);
+}
+
+static void scene_node_bounds(struct wlr_scene_node *node,
+		int x, int y, pixman_region32_t *visible) {
+	struct rect_union ru;
+	rect_union_init(&ru);
+	scene_node_collect_bounds(node, x, y, &ru);
+	region_add_rect_union(visible, &ru);
+}
+
+static void scene_invalidate_render_lists(struct wlr_scene *scene) {
+	struct wlr_scene_output *scene_output;
+	wl_list_for_each(scene_output, &scene->outputs, link) {
+		scene_output->render_list_dirty = true;
+	}
 }
 
 static void scene_update_region(struct wlr_scene *scene,
 		pixman_region32_t *update_region) {
+	// Node visibility may change, which in turn affects the render lists
+	scene_invalidate_render_lists(scene);
+	scene->generation++;
+
 	pixman_region32_t visible;
 	pixman_region32_init(&visible);
 	pixman_region32_copy(&visible, update_region);
@@ -534,6 +875,11 @@ static void scene_node_update(struct wlr_scene_node *node,
 		pixman_region32_t *damage) {
 	struct wlr_scene *scene = scene_node_get_root(node);
 
+	scene_node_invalidate_bounds(node);
+	scene_node_invalidate_caches(node);
+	scene_invalidate_render_lists(scene);
+	scene->generation++;
+
 	int x, y;
 	if (!wlr_scene_node_coords(node, &x, &y)) {
 		if (damage) {
@@ -545,33 +891,38 @@ static void scene_node_update(struct wlr_scene_node *node,
 		return;
 	}
 
-	pixman_region32_t visible;
-	if (!damage) {
-		pixman_region32_init(&visible);
-		scene_node_visibility(node, &visible);
-		damage = &visible;
-	}
+	// The old and new visible regions are collected together, so that the
+	// damage is merged once and added to the damage ring of each output once
+	struct rect_union damage_ru;
+	rect_union_init(&damage_ru);
 
 	pixman_region32_t update_region;
 	pixman_region32_init(&update_region);
-	pixman_region32_copy(&update_region, damage);
+	if (damage) {
+		collect_region(&damage_ru, damage);
+		pixman_region32_copy(&update_region, damage);
+		pixman_region32_fini(damage);
+	} else {
+		scene_node_collect_visibility(node, &damage_ru);
+		pixman_region32_copy(&update_region, rect_union_evaluate(&damage_ru));
+	}
 	scene_node_bounds(node, x, y, &update_region);
 
 	scene_update_region(scene, &update_region);
 	pixman_region32_fini(&update_region);
 
-	scene_node_visibility(node, damage);
-	scene_damage_outputs(scene, damage);
-	pixman_region32_fini(damage);
+	scene_node_collect_visibility(node, &damage_ru);
+	scene_damage_outputs(scene, rect_union_evaluate(&damage_ru));
+	rect_union_finish(&damage_ru);
 }
 
 struct wlr_scene_rect *wlr_scene_rect_create(struct wlr_scene_tree *parent,
 		int width, int height, const float color[static 4]) {
-	struct wlr_scene_rect *scene_rect = calloc(1, sizeof(*scene_rect));
+	assert(parent);
+	struct wlr_scene_rect *scene_rect = scene_node_alloc(parent, WLR_SCENE_NODE_RECT);
 	if (scene_rect == NULL) {
 		return NULL;
 	}
-	assert(parent);
 	scene_node_init(&scene_rect->node, WLR_SCENE_NODE_RECT, parent);
 
 	scene_rect->width = width;
@@ -590,6 +941,7 @@ void wlr_scene_rect_set_size(struct wlr_scene_rect *rect, int width, int height)
 
 	rect->width = width;
 	rect->height = height;
+	scene_node_invalidate_opaque_region(&rect->node);
 	scene_node_update(&rect->node, NULL);
 }
 
@@ -599,16 +951,18 @@ void wlr_scene_rect_set_color(struct wlr_scene_rect *rect, const float color[sta
 	}
 
 	memcpy(rect->color, color, sizeof(rect->color));
+	scene_node_invalidate_opaque_region(&rect->node);
 	scene_node_update(&rect->node, NULL);
 }
 
 struct wlr_scene_buffer *wlr_scene_buffer_create(struct wlr_scene_tree *parent,
 		struct wlr_buffer *buffer) {
-	struct wlr_scene_buffer *scene_buffer = calloc(1, sizeof(*scene_buffer));
+	assert(parent);
+	struct wlr_scene_buffer *scene_buffer =
+		scene_node_alloc(parent, WLR_SCENE_NODE_BUFFER);
 	if (scene_buffer == NULL) {
 		return NULL;
 	}
-	assert(parent);
 	scene_node_init(&scene_buffer->node, WLR_SCENE_NODE_BUFFER, parent);
 
 	if (buffer) {
@@ -640,6 +994,8 @@ void wlr_scene_buffer_set_buffer_with_damage(struct wlr_scene_buffer *scene_buff
 	wlr_texture_destroy(scene_buffer->texture);
 	scene_buffer->texture = NULL;
 
+	scene_node_invalidate_opaque_region(&scene_buffer->node);
+
 	if (buffer) {
 		// if this node used to not be mapped or its previous displayed
 		// buffer region will be different from what the new buffer would
@@ -664,6 +1020,8 @@ void wlr_scene_buffer_set_buffer_with_damage(struct wlr_scene_buffer *scene_buff
 		return;
 	}
 
+	scene_node_invalidate_caches(&scene_buffer->node);
+
 	int lx, ly;
 	if (!wlr_scene_node_coords(&scene_buffer->node, &lx, &ly)) {
 		return;
@@ -766,6 +1124,7 @@ void wlr_scene_buffer_set_opaque_region(struct wlr_scene_buffer *scene_buffer,
 	}
 
 	pixman_region32_copy(&scene_buffer->opaque_region, region);
+	scene_node_invalidate_opaque_region(&scene_buffer->node);
 
 	int x, y;
 	if (!wlr_scene_node_coords(&scene_buffer->node, &x, &y)) {
@@ -802,6 +1161,7 @@ void wlr_scene_buffer_set_dest_size(struct wlr_scene_buffer *scene_buffer,
 
 	scene_buffer->dst_width = width;
 	scene_buffer->dst_height = height;
+	scene_node_invalidate_opaque_region(&scene_buffer->node);
 	scene_node_update(&scene_buffer->node, NULL);
 }
 
@@ -812,6 +1172,7 @@ void wlr_scene_buffer_set_transform(struct wlr_scene_buffer *scene_buffer,
 	}
 
 	scene_buffer->transform = transform;
+	scene_node_invalidate_opaque_region(&scene_buffer->node);
 	scene_node_update(&scene_buffer->node, NULL);
 }
 
@@ -829,6 +1190,7 @@ void wlr_scene_buffer_set_opacity(struct wlr_scene_buffer *scene_buffer,
 	}
 
 	scene_buffer->opacity = opacity;
+	scene_node_invalidate_opaque_region(&scene_buffer->node);
 	scene_node_update(&scene_buffer->node, NULL);
 }
 
@@ -995,6 +1357,9 @@ void wlr_scene_node_reparent(struct wlr_scene_node *node,
 		scene_node_visibility(node, &visible);
 	}
 
+	scene_node_invalidate_bounds(node);
+	scene_node_invalidate_caches(node);
+
 	wl_list_remove(&node->link);
 	node->parent = new_parent;
 	wl_list_insert(new_parent->children.prev, &node->link);
@@ -1054,6 +1419,7 @@ struct node_at_data {
 	double lx, ly;
 	double rx, ry;
 	struct wlr_scene_node *node;
+	int node_x, node_y;
 };
 
 static bool scene_node_at_iterator(struct wlr_scene_node *node,
@@ -1075,9 +1441,79 @@ static bool scene_node_at_iterator(struct wlr_scene_node *node,
 	at_data->rx = rx;
 	at_data->ry = ry;
 	at_data->node = node;
+	at_data->node_x = lx;
+	at_data->node_y = ly;
 	return true;
 }
 
+struct node_at_cache_data {
+	struct wlr_scene_node *node;
+	pixman_region32_t *region;
+};
+
+static bool scene_node_at_cache_iterator(struct wlr_scene_node *node,
+		int lx, int ly, void *data) {
+	struct node_at_cache_data *cache_data = data;
+	if (node == cache_data->node) {
+		return true;
+	}
+
+	int width, height;
+	scene_node_get_size(node, &width, &height);
+
+	pixman_region32_t above;
+	pixman_region32_init_rect(&above, lx, ly, width, height);
+	pixman_region32_subtract(cache_data->region, cache_data->region, &above);
+	pixman_region32_fini(&above);
+
+	return !pixman_region32_not_empty(cache_data->region);
+}
+
+/**
+ * Remember the area where the node found by wlr_scene_node_at() is the
+ * topmost one, so that subsequent queries in that area don't need to walk
+ * the scene-graph again until it changes.
+ *
+ * Nodes above are subtracted as a whole, regardless of their input region,
+ * because it may change without the scene-graph being notified.
+ */
+static void scene_node_at_cache_update(struct wlr_scene *scene,
+		struct wlr_scene_node *root, struct wlr_scene_node *node,
+		int x, int y) {
+	struct wlr_box box = { .x = x, .y = y };
+	scene_node_get_size(node, &box.width, &box.height);
+
+	pixman_region32_t *region = &scene->node_at_cache.region;
+	pixman_region32_fini(region);
+	pixman_region32_init_rect(region, box.x, box.y, box.width, box.height);
+
+	struct node_at_cache_data data = {
+		.node = node,
+		.region = region,
+	};
+	scene_nodes_in_box(root, &box, scene_node_at_cache_iterator, &data);
+
+	scene->node_at_cache.root = root;
+	scene->node_at_cache.node = node;
+	scene->node_at_cache.generation = scene->generation;
+	scene->node_at_cache.x = x;
+	scene->node_at_cache.y = y;
+}
+
+static bool scene_node_at_cached(struct wlr_scene *scene,
+		struct wlr_scene_node *root, struct node_at_data *data) {
+	if (scene->node_at_cache.node == NULL ||
+			scene->node_at_cache.root != root ||
+			scene->node_at_cache.generation != scene->generation ||
+			!pixman_region32_contains_point(&scene->node_at_cache.region,
+				floor(data->lx), floor(data->ly), NULL)) {
+		return false;
+	}
+
+	return scene_node_at_iterator(scene->node_at_cache.node,
+		scene->node_at_cache.x, scene->node_at_cache.y, data);
+}
+
 struct wlr_scene_node *wlr_scene_node_at(struct wlr_scene_node *node,
 		double lx, double ly, double *nx, double *ny) {
 	struct wlr_box box = {
@@ -1092,7 +1528,17 @@ struct wlr_scene_node *wlr_scene_node_at(struct wlr_scene_node *node,
 		.ly = ly
 	};
 
-	if (scene_nodes_in_box(node, &box, scene_node_at_iterator, &data)) {
+	struct wlr_scene *scene = scene_node_get_root(node);
+	bool found = scene_node_at_cached(scene, node, &data);
+	if (!found) {
+		found = scene_nodes_in_box(node, &box, scene_node_at_iterator, &data);
+		if (found) {
+			scene_node_at_cache_update(scene, node, data.node,
+				data.node_x, data.node_y);
+		}
+	}
+
+	if (found) {
 		if (nx) {
 			*nx = data.rx;
 		}
@@ -1114,10 +1560,51 @@ struct render_list_entry {
 static void scene_entry_render(struct render_list_entry *entry, const struct render_data *data) {
 	struct wlr_scene_node *node = entry->node;
 
+	int x = entry->x - data->logical.x;
+	int y = entry->y - data->logical.y;
+
+	struct wlr_box dst_box = {
+		.x = x,
+		.y = y,
+	};
+	if (node->type == WLR_SCENE_NODE_TREE) {
+		const struct wlr_box *bounds =
+			scene_tree_get_bounds(wlr_scene_tree_from_node(node));
+		dst_box.x += bounds->x;
+		dst_box.y += bounds->y;
+		dst_box.width = bounds->width;
+		dst_box.height = bounds->height;
+	} else {
+		scene_node_get_size(node, &dst_box.width, &dst_box.height);
+	}
+
+	// Skip nodes outside of the damaged tiles before computing their
+	// render region. Scaling the visible region rounds outwards, hence the
+	// margin.
+	if (data->damage_tiles != NULL) {
+		struct wlr_box tiles_box = dst_box;
+		scale_box(&tiles_box, data->scale);
+		pixman_box32_t box = {
+			.x1 = tiles_box.x - 2,
+			.y1 = tiles_box.y - 2,
+			.x2 = tiles_box.x + tiles_box.width + 2,
+			.y2 = tiles_box.y + tiles_box.height + 2,
+		};
+		if (!tile_bitmap_intersects_box(data->damage_tiles, &box)) {
+			return;
+		}
+	}
+
 	pixman_region32_t render_region;
 	pixman_region32_init(&render_region);
-	pixman_region32_copy(&render_region, &node->visible);
-	pixman_region32_translate(&render_region, -data->logical.x, -data->logical.y);
+	if (data->cache_pass) {
+		pixman_region32_union_rect(&render_region, &render_region,
+			dst_box.x, dst_box.y, dst_box.width, dst_box.height);
+	} else {
+		pixman_region32_copy(&render_region, node->type == WLR_SCENE_NODE_TREE ?
+			&wlr_scene_tree_from_node(node)->cache_visible : &node->visible);
+		pixman_region32_translate(&render_region, -data->logical.x, -data->logical.y);
+	}
 	scale_output_damage(&render_region, data->scale);
 	pixman_region32_intersect(&render_region, &render_region, &data->damage);
 	if (!pixman_region32_not_empty(&render_region)) {
@@ -1125,28 +1612,57 @@ static void scene_entry_render(struct render_list_entry *entry, const struct ren
 		return;
 	}
 
-	int x = entry->x - data->logical.x;
-	int y = entry->y - data->logical.y;
-
-	struct wlr_box dst_box = {
-		.x = x,
-		.y = y,
-	};
-	scene_node_get_size(node, &dst_box.width, &dst_box.height);
-	scale_box(&dst_box, data->scale);
-
+	// Split buffers into a part drawn without blending and the rest, so
+	// that renderers can skip reading the destination for opaque pixels.
+	// render_region keeps the part which needs blending.
 	pixman_region32_t opaque;
 	pixman_region32_init(&opaque);
-	scene_node_opaque_region(node, x, y, &opaque);
-	scale_output_damage(&opaque, data->scale);
-	pixman_region32_subtract(&opaque, &render_region, &opaque);
+	const pixman_region32_t *node_opaque =
+		scene_node_opaque_region(node, entry->x, entry->y);
+	if (node->type == WLR_SCENE_NODE_BUFFER &&
+			pixman_region32_not_empty(node_opaque)) {
+		// Scaling rounds outwards, so output pixels partially covered by
+		// translucent content end up blended
+		pixman_region32_t translucent;
+		pixman_region32_init_rect(&translucent, entry->x, entry->y,
+			dst_box.width, dst_box.height);
+		pixman_region32_subtract(&translucent, &translucent, node_opaque);
+		pixman_region32_translate(&translucent, -data->logical.x, -data->logical.y);
+		scale_output_damage(&translucent, data->scale);
+
+		pixman_region32_subtract(&opaque, &render_region, &translucent);
+		pixman_region32_intersect(&render_region, &render_region, &translucent);
+		pixman_region32_fini(&translucent);
+
+		transform_output_damage(&opaque, data);
+	}
+
+	scale_box(&dst_box, data->scale);
+	// The cache buffer of a tree has this size, see scene_tree_update_cache()
+	int scaled_width = dst_box.width;
+	int scaled_height = dst_box.height;
 
 	transform_output_box(&dst_box, data);
 	transform_output_damage(&render_region, data);
 
 	switch (node->type) {
-	case WLR_SCENE_NODE_TREE:
-		assert(false);
+	case WLR_SCENE_NODE_TREE:;
+		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
+		assert(scene_tree->cached);
+		struct wlr_scene_tree_cache *cache = scene_tree_get_cache(scene_tree,
+			data->output->output->renderer, data->scale,
+			scaled_width, scaled_height);
+		if (cache == NULL || cache->texture == NULL) {
+			break;
+		}
+
+		wlr_render_pass_add_texture(data->render_pass, &(struct wlr_render_texture_options) {
+			.texture = cache->texture,
+			.dst_box = dst_box,
+			.transform = data->transform,
+			.clip = &render_region,
+			.blend_mode = WLR_RENDER_BLEND_MODE_PREMULTIPLIED,
+		});
 		break;
 	case WLR_SCENE_NODE_RECT:;
 		struct wlr_scene_rect *scene_rect = wlr_scene_rect_from_node(node);
@@ -1166,33 +1682,48 @@ static void scene_entry_render(struct render_list_entry *entry, const struct ren
 		struct wlr_scene_buffer *scene_buffer = wlr_scene_buffer_from_node(node);
 		assert(scene_buffer->buffer);
 
+		bool had_texture = scene_buffer->texture != NULL;
 		struct wlr_texture *texture = scene_buffer_get_texture(scene_buffer,
 			data->output->output->renderer);
 		if (texture == NULL) {
 			break;
 		}
 
+		if (data->stats && !had_texture && scene_buffer->texture != NULL) {
+			data->stats->texture_uploads++;
+		}
+
 		enum wl_output_transform transform =
 			wlr_output_transform_invert(scene_buffer->transform);
 		transform = wlr_output_transform_compose(transform, data->transform);
 
-		wlr_render_pass_add_texture(data->render_pass, &(struct wlr_render_texture_options) {
+		struct wlr_render_texture_options options = {
 			.texture = texture,
 			.src_box = scene_buffer->src_box,
 			.dst_box = dst_box,
 			.transform = transform,
-			.clip = &render_region,
 			.alpha = &scene_buffer->opacity,
 			.filter_mode = scene_buffer->filter_mode,
-			.blend_mode = pixman_region32_not_empty(&opaque) ?
-				WLR_RENDER_BLEND_MODE_PREMULTIPLIED : WLR_RENDER_BLEND_MODE_NONE,
-		});
-
-		struct wlr_scene_output_sample_event sample_event = {
-			.output = data->output,
-			.direct_scanout = false,
 		};
-		wl_signal_emit_mutable(&scene_buffer->events.output_sample, &sample_event);
+		if (pixman_region32_not_empty(&opaque)) {
+			options.clip = &opaque;
+			options.blend_mode = WLR_RENDER_BLEND_MODE_NONE;
+			wlr_render_pass_add_texture(data->render_pass, &options);
+		}
+		if (pixman_region32_not_empty(&render_region)) {
+			options.clip = &render_region;
+			options.blend_mode = WLR_RENDER_BLEND_MODE_PREMULTIPLIED;
+			wlr_render_pass_add_texture(data->render_pass, &options);
+		}
+
+		if (!data->cache_pass) {
+			struct wlr_scene_output_sample_event sample_event = {
+				.output = data->output,
+				.direct_scanout = false,
+			};
+			wl_signal_emit_mutable(&scene_buffer->events.output_sample,
+				&sample_event);
+		}
 		break;
 	}
 
@@ -1234,6 +1765,22 @@ void wlr_scene_set_linux_dmabuf_v1(struct wlr_scene *scene,
 	wl_signal_add(&linux_dmabuf_v1->events.destroy, &scene->linux_dmabuf_v1_destroy);
 }
 
+void wlr_scene_set_occluded_frame_interval(struct wlr_scene *scene,
+		int interval_ms) {
+	assert(interval_ms >= 0);
+	scene->occluded_frame_interval = interval_ms;
+}
+
+void wlr_scene_set_damage_tile_size(struct wlr_scene *scene, int tile_size) {
+	assert(tile_size >= 0);
+	scene->damage_tile_size = tile_size;
+
+	struct wlr_scene_output *scene_output;
+	wl_list_for_each(scene_output, &scene->outputs, link) {
+		wlr_damage_ring_set_tile_size(&scene_output->damage_ring, tile_size);
+	}
+}
+
 static void scene_output_handle_destroy(struct wlr_addon *addon) {
 	struct wlr_scene_output *scene_output =
 		wl_container_of(addon, scene_output, addon);
@@ -1262,6 +1809,7 @@ static void scene_node_output_update(struct wlr_scene_node *node,
 
 static void scene_output_update_geometry(struct wlr_scene_output *scene_output,
 		bool force_update) {
+	scene_output->render_list_dirty = true;
 	wlr_damage_ring_add_whole(&scene_output->damage_ring);
 	wlr_output_schedule_frame(scene_output->output);
 
@@ -1318,6 +1866,8 @@ struct wlr_scene_output *wlr_scene_output_create(struct wlr_scene *scene,
 	wlr_addon_init(&scene_output->addon, &output->addons, scene, &output_addon_impl);
 
 	wlr_damage_ring_init(&scene_output->damage_ring);
+	wlr_damage_ring_set_tile_size(&scene_output->damage_ring,
+		scene->damage_tile_size);
 	wl_list_init(&scene_output->damage_highlight_regions);
 
 	int prev_output_index = -1;
@@ -1353,6 +1903,35 @@ struct wlr_scene_output *wlr_scene_output_create(struct wlr_scene *scene,
 	return scene_output;
 }
 
+struct scene_output_layer {
+	struct wlr_output_layer *layer;
+	// Node displayed on the layer by the last frame, may be NULL. Only used
+	// for comparison, must not be dereferenced.
+	struct wlr_scene_node *node;
+};
+
+void wlr_scene_output_set_max_layers(struct wlr_scene_output *scene_output,
+		size_t max_layers) {
+	if (scene_output->max_layers == max_layers) {
+		return;
+	}
+
+	struct scene_output_layer *layers = scene_output->layers.data;
+	size_t layers_len = scene_output->layers.size / sizeof(layers[0]);
+	for (size_t i = max_layers; i < layers_len; i++) {
+		wlr_output_layer_destroy(layers[i].layer);
+	}
+	if (layers_len > max_layers) {
+		scene_output->layers.size = max_layers * sizeof(layers[0]);
+	}
+
+	scene_output->max_layers = max_layers;
+
+	// Nodes previously displayed on layers need to be composited again
+	wlr_damage_ring_add_whole(&scene_output->damage_ring);
+	wlr_output_schedule_frame(scene_output->output);
+}
+
 static void highlight_region_destroy(struct highlight_region *damage) {
 	wl_list_remove(&damage->link);
 	pixman_region32_fini(&damage->region);
@@ -1374,8 +1953,19 @@ void wlr_scene_output_destroy(struct wlr_scene_output *scene_output) {
 		highlight_region_destroy(damage);
 	}
 
+	struct scene_output_layer *layer;
+	wl_array_for_each(layer, &scene_output->layers) {
+		wlr_output_layer_destroy(layer->layer);
+	}
+	wl_array_release(&scene_output->layers);
+	wl_array_release(&scene_output->layer_states);
+
 	wlr_addon_finish(&scene_output->addon);
 	wlr_damage_ring_finish(&scene_output->damage_ring);
+	if (scene_output->damage_tiles != NULL) {
+		tile_bitmap_finish(scene_output->damage_tiles);
+		free(scene_output->damage_tiles);
+	}
 	wl_list_remove(&scene_output->link);
 	wl_list_remove(&scene_output->output_commit.link);
 	wl_list_remove(&scene_output->output_damage.link);
@@ -1425,16 +2015,171 @@ static bool scene_node_invisible(struct wlr_scene_node *node) {
 	return false;
 }
 
+static void scene_tree_render_cache_node(struct wlr_scene_node *node,
+		int lx, int ly, const struct render_data *data) {
+	if (!node->enabled) {
+		return;
+	}
+
+	if (node->type == WLR_SCENE_NODE_TREE) {
+		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
+		struct wlr_scene_node *child;
+		wl_list_for_each(child, &scene_tree->children, link) {
+			scene_tree_render_cache_node(child,
+				lx + child->x, ly + child->y, data);
+		}
+		return;
+	}
+
+	if (scene_node_invisible(node)) {
+		return;
+	}
+
+	struct render_list_entry entry = {
+		.node = node,
+		.x = lx,
+		.y = ly,
+	};
+	scene_entry_render(&entry, data);
+}
+
+/**
+ * Make sure the contents of a cached tree at the given position are
+ * up-to-date for the output being rendered. Must be called outside of any
+ * render pass.
+ */
+static void scene_tree_update_cache(struct wlr_scene_tree *tree, int lx, int ly,
+		const struct render_data *output_data) {
+	struct wlr_scene *scene = scene_node_get_root(&tree->node);
+	struct wlr_output *output = output_data->output->output;
+
+	if (tree->cache_visible_generation != scene->generation) {
+		pixman_region32_clear(&tree->cache_visible);
+		scene_node_visibility(&tree->node, &tree->cache_visible);
+		tree->cache_visible_generation = scene->generation;
+	}
+
+	// Size the buffer like the destination box in scene_entry_render(), so
+	// that the cache isn't resampled
+	const struct wlr_box *bounds = scene_tree_get_bounds(tree);
+	struct wlr_box box = {
+		.x = lx + bounds->x - output_data->logical.x,
+		.y = ly + bounds->y - output_data->logical.y,
+		.width = bounds->width,
+		.height = bounds->height,
+	};
+	scale_box(&box, output_data->scale);
+	int width = box.width;
+	int height = box.height;
+	if (width <= 0 || height <= 0) {
+		return;
+	}
+
+	struct wlr_scene_tree_cache *cache = scene_tree_get_cache(tree,
+		output->renderer, output_data->scale, width, height);
+	if (cache != NULL && cache->texture != NULL &&
+			cache->generation == tree->cache_generation) {
+		return;
+	}
+
+	if (cache == NULL) {
+		size_t n_caches = tree->caches.size / sizeof(*cache);
+		if (n_caches >= MAX_TREE_CACHES) {
+			// Evict the oldest cache
+			struct wlr_scene_tree_cache *oldest = tree->caches.data;
+			tree_cache_release_buffer(oldest);
+			memmove(oldest, oldest + 1, (n_caches - 1) * sizeof(*cache));
+			tree->caches.size -= sizeof(*cache);
+		}
+
+		struct wlr_drm_format format = {0};
+		if (!output_pick_format(output, NULL, &format, DRM_FORMAT_ARGB8888)) {
+			wlr_log(WLR_DEBUG, "Failed to pick scene tree cache format");
+			return;
+		}
+
+		struct wlr_buffer *buffer = wlr_allocator_create_buffer(output->allocator,
+			width, height, &format);
+		wlr_drm_format_finish(&format);
+		if (buffer == NULL) {
+			wlr_log(WLR_ERROR, "Failed to allocate scene tree cache buffer");
+			return;
+		}
+
+		cache = wl_array_add(&tree->caches, sizeof(*cache));
+		if (cache == NULL) {
+			wlr_buffer_drop(buffer);
+			return;
+		}
+		*cache = (struct wlr_scene_tree_cache){
+			.renderer = output->renderer,
+			.scale = output_data->scale,
+			.buffer = buffer,
+		};
+	}
+
+	struct wlr_render_pass *pass = wlr_renderer_begin_buffer_pass(output->renderer,
+		cache->buffer, NULL);
+	if (pass == NULL) {
+		return;
+	}
+
+	wlr_render_pass_add_rect(pass, &(struct wlr_render_rect_options){
+		.box = { .width = width, .height = height },
+		.color = { .r = 0, .g = 0, .b = 0, .a = 0 },
+		.blend_mode = WLR_RENDER_BLEND_MODE_NONE,
+	});
+
+	struct render_data data = {
+		.transform = WL_OUTPUT_TRANSFORM_NORMAL,
+		.scale = output_data->scale,
+		.logical = {
+			.x = lx + bounds->x,
+			.y = ly + bounds->y,
+			.width = bounds->width,
+			.height = bounds->height,
+		},
+		.trans_width = width,
+		.trans_height = height,
+		.output = output_data->output,
+		.render_pass = pass,
+		.cache_pass = true,
+	};
+	pixman_region32_init_rect(&data.damage, 0, 0, width, height);
+
+	struct wlr_scene_node *child;
+	wl_list_for_each(child, &tree->children, link) {
+		scene_tree_render_cache_node(child, lx + child->x, ly + child->y, &data);
+	}
+
+	if (!wlr_render_pass_submit(pass)) {
+		pixman_region32_fini(&data.damage);
+		return;
+	}
+
+	if (cache->texture == NULL || !wlr_texture_update_from_buffer(cache->texture,
+			cache->buffer, &data.damage)) {
+		wlr_texture_destroy(cache->texture);
+		cache->texture = wlr_texture_from_buffer(output->renderer, cache->buffer);
+	}
+	pixman_region32_fini(&data.damage);
+
+	cache->generation = tree->cache_generation;
+}
+
 struct render_list_constructor_data {
 	struct wlr_box box;
 	struct wl_array *render_list;
 	bool calculate_visibility;
+	size_t nodes_visited;
 };
 
 static bool construct_render_list_iterator(struct wlr_scene_node *node,
 		int lx, int ly, void *_data) {
 	struct render_list_constructor_data *data = _data;
 
+	data->nodes_visited++;
+
 	if (scene_node_invisible(node)) {
 		return false;
 	}
@@ -1477,6 +2222,77 @@ static bool construct_render_list_iterator(struct wlr_scene_node *node,
 	return false;
 }
 
+/**
+ * Same as _scene_nodes_in_box() with construct_render_list_iterator(), except
+ * that cached trees are added to the render list as a whole.
+ */
+static void scene_node_construct_render_list(struct wlr_scene_node *node,
+		int lx, int ly, struct render_list_constructor_data *data) {
+	if (!node->enabled) {
+		return;
+	}
+
+	if (node->type != WLR_SCENE_NODE_TREE) {
+		struct wlr_box node_box = { .x = lx, .y = ly };
+		scene_node_get_size(node, &node_box.width, &node_box.height);
+		if (wlr_box_intersection(&node_box, &node_box, &data->box)) {
+			construct_render_list_iterator(node, lx, ly, data);
+		}
+		return;
+	}
+
+	struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
+	struct wlr_box bounds = *scene_tree_get_bounds(scene_tree);
+	bounds.x += lx;
+	bounds.y += ly;
+	if (!wlr_box_intersection(&bounds, &bounds, &data->box)) {
+		return;
+	}
+
+	if (scene_tree->cached) {
+		data->nodes_visited++;
+
+		struct render_list_entry *entry =
+			wl_array_add(data->render_list, sizeof(*entry));
+		if (entry) {
+			*entry = (struct render_list_entry){
+				.node = node,
+				.x = lx,
+				.y = ly,
+			};
+		}
+		return;
+	}
+
+	struct wlr_scene_node *child;
+	wl_list_for_each_reverse(child, &scene_tree->children, link) {
+		scene_node_construct_render_list(child,
+			lx + child->x, ly + child->y, data);
+	}
+}
+
+static size_t scene_output_construct_render_list(
+		struct wlr_scene_output *scene_output, const struct wlr_box *box) {
+	struct render_list_constructor_data list_con = {
+		.box = *box,
+		.render_list = &scene_output->render_list,
+		.calculate_visibility = scene_output->scene->calculate_visibility,
+	};
+
+	struct wlr_scene_node *root = &scene_output->scene->tree.node;
+	int x, y;
+	wlr_scene_node_coords(root, &x, &y);
+
+	list_con.render_list->size = 0;
+	scene_node_construct_render_list(root, x, y, &list_con);
+	array_realloc(list_con.render_list, list_con.render_list->size);
+
+	scene_output->render_list_dirty = false;
+	scene_output->render_list_box = *box;
+
+	return list_con.nodes_visited;
+}
+
 static void output_state_apply_damage(const struct render_data *data,
 		struct wlr_output_state *state) {
 	pixman_region32_t frame_damage;
@@ -1611,6 +2427,226 @@ static bool scene_entry_try_direct_scanout(struct render_list_entry *entry,
 	return true;
 }
 
+/**
+ * Create the scene output's layers if necessary, and attach them to the state
+ * with no buffer. Once created, layers need to be part of every commit, else
+ * stale buffers would stay on screen.
+ */
+static bool scene_output_init_layers(struct wlr_scene_output *scene_output,
+		struct wlr_output_state *state) {
+	size_t layers_len =
+		scene_output->layers.size / sizeof(struct scene_output_layer);
+	while (layers_len < scene_output->max_layers) {
+		struct wlr_output_layer *output_layer =
+			wlr_output_layer_create(scene_output->output);
+		if (output_layer == NULL) {
+			break;
+		}
+
+		struct scene_output_layer *layer =
+			wl_array_add(&scene_output->layers, sizeof(*layer));
+		if (layer == NULL) {
+			wlr_output_layer_destroy(output_layer);
+			break;
+		}
+
+		*layer = (struct scene_output_layer){ .layer = output_layer };
+		layers_len++;
+	}
+
+	if (layers_len == 0) {
+		return false;
+	}
+
+	scene_output->layer_states.size = 0;
+	struct scene_output_layer *layer;
+	wl_array_for_each(layer, &scene_output->layers) {
+		struct wlr_output_layer_state *layer_state =
+			wl_array_add(&scene_output->layer_states, sizeof(*layer_state));
+		if (layer_state == NULL) {
+			return false;
+		}
+
+		*layer_state = (struct wlr_output_layer_state){
+			.layer = layer->layer,
+		};
+	}
+
+	wlr_output_state_set_layers(state, scene_output->layer_states.data,
+		layers_len);
+	return true;
+}
+
+static bool scene_entry_get_layer_state(struct render_list_entry *entry,
+		const struct render_data *data,
+		struct wlr_output_layer_state *layer_state) {
+	struct wlr_scene_node *node = entry->node;
+	if (node->type != WLR_SCENE_NODE_BUFFER) {
+		return false;
+	}
+
+	struct wlr_scene_buffer *buffer = wlr_scene_buffer_from_node(node);
+	if (buffer->opacity != 1) {
+		return false;
+	}
+
+	// Output layers have no notion of transforms
+	if (buffer->transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+			data->transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+		return false;
+	}
+
+	struct wlr_box node_box = { .x = entry->x, .y = entry->y };
+	scene_node_get_size(node, &node_box.width, &node_box.height);
+
+	// Layers are displayed above everything that gets composited, so the
+	// node must not be occluded by anything. Without visibility
+	// calculation, node->visible doesn't account for occlusion.
+	if (!data->output->scene->calculate_visibility) {
+		return false;
+	}
+	pixman_box32_t node_rect = {
+		.x1 = node_box.x,
+		.y1 = node_box.y,
+		.x2 = node_box.x + node_box.width,
+		.y2 = node_box.y + node_box.height,
+	};
+	if (pixman_region32_contains_rectangle(&node->visible, &node_rect) !=
+			PIXMAN_REGION_IN) {
+		return false;
+	}
+
+	struct wlr_box dst_box = {
+		.x = node_box.x - data->logical.x,
+		.y = node_box.y - data->logical.y,
+		.width = node_box.width,
+		.height = node_box.height,
+	};
+	scale_box(&dst_box, data->scale);
+
+	struct wlr_box output_box = {
+		.width = data->trans_width,
+		.height = data->trans_height,
+	};
+	struct wlr_box intersection;
+	if (!wlr_box_intersection(&intersection, &dst_box, &output_box) ||
+			!wlr_box_equal(&intersection, &dst_box)) {
+		return false;
+	}
+
+	layer_state->buffer = buffer->buffer;
+	layer_state->src_box = buffer->src_box;
+	layer_state->dst_box = dst_box;
+	return true;
+}
+
+/**
+ * Try to offload the topmost entries of the render list to output layers.
+ *
+ * Returns the number of entries, starting from the top of the render list,
+ * which have been accepted by the backend and don't need to be composited.
+ */
+static int scene_output_offload_layers(struct wlr_scene_output *scene_output,
+		struct wlr_output_state *state, const struct render_data *data,
+		struct render_list_entry *list_data, int list_len) {
+	struct scene_output_layer *layers = scene_output->layers.data;
+	struct wlr_output_layer_state *layer_states =
+		scene_output->layer_states.data;
+	int layers_len = scene_output->layer_states.size / sizeof(layer_states[0]);
+
+	bool allowed = scene_output->scene->debug_damage_option !=
+			WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT &&
+		!(state->committed & (WLR_OUTPUT_STATE_MODE |
+			WLR_OUTPUT_STATE_ENABLED |
+			WLR_OUTPUT_STATE_RENDER_FORMAT)) &&
+		wlr_output_is_direct_scanout_allowed(scene_output->output);
+
+	// Only a contiguous run of entries from the top of the render list can
+	// be offloaded, since layers are displayed above the composited buffer.
+	// Layer states are ordered from bottom to top.
+	int candidates = 0;
+	while (allowed && candidates < layers_len && candidates < list_len) {
+		struct render_list_entry *entry = &list_data[candidates];
+		struct wlr_output_layer_state candidate = {0};
+		if (!scene_entry_get_layer_state(entry, data, &candidate)) {
+			break;
+		}
+		candidates++;
+	}
+
+	for (int i = 0; i < candidates; i++) {
+		struct wlr_output_layer_state *layer_state =
+			&layer_states[candidates - 1 - i];
+		scene_entry_get_layer_state(&list_data[i], data, layer_state);
+	}
+
+	int offloaded = 0;
+	if (candidates > 0 && wlr_output_test_state(scene_output->output, state)) {
+		while (offloaded < candidates &&
+				layer_states[candidates - 1 - offloaded].accepted) {
+			offloaded++;
+		}
+	}
+
+	if (offloaded < candidates) {
+		// Entries below a rejected one must be composited too, otherwise
+		// they'd end up above it
+		for (int i = offloaded; i < candidates; i++) {
+			layer_states[candidates - 1 - i].buffer = NULL;
+		}
+
+		if (offloaded > 0 &&
+				!wlr_output_test_state(scene_output->output, state)) {
+			for (int i = 0; i < offloaded; i++) {
+				layer_states[candidates - 1 - i].buffer = NULL;
+			}
+			offloaded = 0;
+		}
+	}
+
+	bool changed = false;
+	for (int i = 0; i < layers_len; i++) {
+		int entry_index = candidates - 1 - i;
+		struct wlr_scene_node *node = NULL;
+		if (entry_index >= 0 && entry_index < offloaded) {
+			node = list_data[entry_index].node;
+		}
+
+		if (layers[i].node != node) {
+			layers[i].node = node;
+			changed = true;
+		}
+	}
+
+	if (changed) {
+		// Nodes moved between layers and the composited buffer
+		wlr_damage_ring_add_whole(&scene_output->damage_ring);
+	}
+
+	for (int i = 0; i < offloaded; i++) {
+		struct render_list_entry *entry = &list_data[i];
+		struct wlr_scene_buffer *buffer = wlr_scene_buffer_from_node(entry->node);
+
+		if (buffer->primary_output == scene_output) {
+			struct wlr_linux_dmabuf_feedback_v1_init_options options = {
+				.main_renderer = scene_output->output->renderer,
+				.scanout_primary_output = scene_output->output,
+			};
+
+			scene_buffer_send_dmabuf_feedback(scene_output->scene, buffer, &options);
+			entry->sent_dmabuf_feedback = true;
+		}
+
+		struct wlr_scene_output_sample_event sample_event = {
+			.output = scene_output,
+			.direct_scanout = true,
+		};
+		wl_signal_emit_mutable(&buffer->events.output_sample, &sample_event);
+	}
+
+	return offloaded;
+}
+
 bool wlr_scene_output_commit(struct wlr_scene_output *scene_output,
 		const struct wlr_scene_output_state_options *options) {
 	if (!scene_output->output->needs_frame && !pixman_region32_not_empty(
@@ -1637,6 +2673,39 @@ out:
 	return ok;
 }
 
+/**
+ * Rasterize the damage of the frame being rendered into the tiles of the
+ * output. Returns NULL on allocation failure.
+ */
+static const struct tile_bitmap *scene_output_update_damage_tiles(
+		struct wlr_scene_output *scene_output, const pixman_region32_t *damage,
+		int width, int height) {
+	int tile_size = scene_output->scene->damage_tile_size;
+	struct tile_bitmap *tiles = scene_output->damage_tiles;
+	if (tiles == NULL) {
+		tiles = calloc(1, sizeof(*tiles));
+		if (tiles == NULL) {
+			return NULL;
+		}
+		scene_output->damage_tiles = tiles;
+	} else if (tiles->width == width && tiles->height == height &&
+			tiles->tile_size == tile_size) {
+		tile_bitmap_clear(tiles);
+		tile_bitmap_add_region(tiles, damage);
+		return tiles;
+	}
+
+	tile_bitmap_finish(tiles);
+	if (!tile_bitmap_init(tiles, width, height, tile_size)) {
+		tile_bitmap_finish(tiles);
+		free(tiles);
+		scene_output->damage_tiles = NULL;
+		return NULL;
+	}
+	tile_bitmap_add_region(tiles, damage);
+	return tiles;
+}
+
 bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 		struct wlr_output_state *state, const struct wlr_scene_output_state_options *options) {
 	struct wlr_scene_output_state_options default_options = {0};
@@ -1651,6 +2720,11 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 		*timer = (struct wlr_scene_timer){0};
 	}
 
+	struct wlr_scene_output_stats *stats = options->stats;
+	if (stats) {
+		*stats = (struct wlr_scene_output_stats){0};
+	}
+
 	if ((state->committed & WLR_OUTPUT_STATE_ENABLED) && !state->enabled) {
 		// if the state is being disabled, do nothing.
 		return true;
@@ -1665,6 +2739,7 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 		.scale = output->scale,
 		.logical = { .x = scene_output->x, .y = scene_output->y },
 		.output = scene_output,
+		.stats = stats,
 	};
 
 	output_pending_resolution(output, state,
@@ -1695,19 +2770,33 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 	render_data.logical.width = render_data.trans_width / render_data.scale;
 	render_data.logical.height = render_data.trans_height / render_data.scale;
 
-	struct render_list_constructor_data list_con = {
-		.box = render_data.logical,
-		.render_list = &scene_output->render_list,
-		.calculate_visibility = scene_output->scene->calculate_visibility,
-	};
+	// The render list only depends on the scene-graph structure and node
+	// visibility, so it can be reused as long as neither changed. This is
+	// the common case of a frame where only buffer contents got updated.
+	bool reuse_render_list = !scene_output->render_list_dirty &&
+		wlr_box_equal(&scene_output->render_list_box, &render_data.logical);
+	if (!reuse_render_list) {
+		size_t nodes_visited = scene_output_construct_render_list(
+			scene_output, &render_data.logical);
+
+		if (stats) {
+			stats->nodes_visited = nodes_visited;
+		}
+	}
+	if (timer) {
+		timer->render_list_reused = reuse_render_list;
+	}
 
-	list_con.render_list->size = 0;
-	scene_nodes_in_box(&scene_output->scene->tree.node, &list_con.box,
-		construct_render_list_iterator, &list_con);
-	array_realloc(list_con.render_list, list_con.render_list->size);
+	struct render_list_entry *list_data = scene_output->render_list.data;
+	int list_len = scene_output->render_list.size / sizeof(*list_data);
+	if (stats) {
+		stats->render_list_len = list_len;
+	}
+	for (int i = 0; i < list_len; i++) {
+		list_data[i].sent_dmabuf_feedback = false;
+	}
 
-	struct render_list_entry *list_data = list_con.render_list->data;
-	int list_len = list_con.render_list->size / sizeof(*list_data);
+	bool has_layers = scene_output_init_layers(scene_output, state);
 
 	bool scanout = list_len == 1 &&
 		scene_entry_try_direct_scanout(&list_data[0], state, &render_data);
@@ -1722,6 +2811,10 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 		}
 	}
 
+	if (stats) {
+		stats->direct_scanout = scanout;
+	}
+
 	if (scanout) {
 		if (timer) {
 			struct timespec end_time, duration;
@@ -1732,6 +2825,15 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 		return true;
 	}
 
+	int offloaded = 0;
+	if (has_layers) {
+		offloaded = scene_output_offload_layers(scene_output, state,
+			&render_data, list_data, list_len);
+	}
+	if (stats) {
+		stats->offloaded_layers = offloaded;
+	}
+
 	if (debug_damage == WLR_SCENE_DEBUG_DAMAGE_RERENDER) {
 		wlr_damage_ring_add_whole(&scene_output->damage_ring);
 	}
@@ -1753,13 +2855,28 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 			}
 		}
 
-		pixman_region32_t acc_damage;
-		pixman_region32_init(&acc_damage);
+		// The accumulated damage is only evaluated when a region overlaps
+		// its bounding box, most regions are disjoint from newer ones
+		struct rect_union acc_damage;
+		rect_union_init(&acc_damage);
 		struct highlight_region *damage, *tmp_damage;
 		wl_list_for_each_safe(damage, tmp_damage, regions, link) {
 			// remove overlaping damage regions
-			pixman_region32_subtract(&damage->region, &damage->region, &acc_damage);
-			pixman_region32_union(&acc_damage, &acc_damage, &damage->region);
+			const pixman_box32_t *extents =
+				pixman_region32_extents(&damage->region);
+			const pixman_box32_t *acc_extents = &acc_damage.bounding_box;
+			if (extents->x1 < acc_extents->x2 && extents->x2 > acc_extents->x1 &&
+					extents->y1 < acc_extents->y2 && extents->y2 > acc_extents->y1) {
+				pixman_region32_subtract(&damage->region, &damage->region,
+					rect_union_evaluate(&acc_damage));
+			}
+
+			int nrects;
+			const pixman_box32_t *rects =
+				pixman_region32_rectangles(&damage->region, &nrects);
+			for (int i = 0; i < nrects; i++) {
+				rect_union_add(&acc_damage, rects[i]);
+			}
 
 			// if this damage is too old or has nothing in it, get rid of it
 			struct timespec time_diff;
@@ -1770,13 +2887,24 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 			}
 		}
 
-		wlr_damage_ring_add(&scene_output->damage_ring, &acc_damage);
-		pixman_region32_fini(&acc_damage);
+		wlr_damage_ring_add(&scene_output->damage_ring,
+			rect_union_evaluate(&acc_damage));
+		rect_union_finish(&acc_damage);
 	}
 
 	wlr_damage_ring_set_bounds(&scene_output->damage_ring,
 		render_data.trans_width, render_data.trans_height);
 
+	// Cached trees are rendered in their own pass, so this needs to happen
+	// before the output pass begins
+	for (int i = list_len - 1; i >= offloaded; i--) {
+		struct render_list_entry *entry = &list_data[i];
+		if (entry->node->type == WLR_SCENE_NODE_TREE) {
+			scene_tree_update_cache(wlr_scene_tree_from_node(entry->node),
+				entry->x, entry->y, &render_data);
+		}
+	}
+
 	if (!wlr_output_configure_primary_swapchain(output, state, &output->swapchain)) {
 		return false;
 	}
@@ -1807,14 +2935,34 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 
 	render_data.render_pass = render_pass;
 	pixman_region32_init(&render_data.damage);
+	wlr_damage_ring_set_rect_cost(&scene_output->damage_ring,
+		output->renderer->damage_rect_cost);
 	wlr_damage_ring_get_buffer_damage(&scene_output->damage_ring,
 		buffer_age, &render_data.damage);
 
+	// Swapchains with more buffers than the damage ring remembers would
+	// always be redrawn fully, grow the history to match
+	if (buffer_age > 1 && buffer_age - 1 <= SCENE_DAMAGE_RING_MAX_PREVIOUS_LEN &&
+			(size_t)buffer_age - 1 > scene_output->damage_ring.previous_len) {
+		wlr_damage_ring_set_previous_len(&scene_output->damage_ring,
+			buffer_age - 1);
+	}
+
 	// HACK: this should really be done by the compositor rather than us
 	if (!wlr_output_handle_damage(output, &render_data.damage)) {
 		wlr_log(WLR_ERROR, "Error during handle_damage call");
 	}
 
+	if (scene_output->scene->damage_tile_size > 0) {
+		render_data.damage_tiles = scene_output_update_damage_tiles(scene_output,
+			&render_data.damage, render_data.trans_width, render_data.trans_height);
+	}
+
+	if (stats) {
+		stats->damage_rects = pixman_region32_n_rects(&render_data.damage);
+		stats->damage_area = region_area(&render_data.damage);
+	}
+
 	pixman_region32_t background;
 	pixman_region32_init(&background);
 	pixman_region32_copy(&background, &render_data.damage);
@@ -1833,11 +2981,23 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 			// rendering in that black rect region, consider the node's visibility.
 			pixman_region32_t opaque;
 			pixman_region32_init(&opaque);
-			scene_node_opaque_region(entry->node, entry->x, entry->y, &opaque);
-			pixman_region32_intersect(&opaque, &opaque, &entry->node->visible);
+			pixman_region32_intersect(&opaque,
+				scene_node_opaque_region(entry->node, entry->x, entry->y),
+				&entry->node->visible);
 
 			pixman_region32_translate(&opaque, -scene_output->x, -scene_output->y);
 			wlr_region_scale(&opaque, &opaque, render_data.scale);
+
+			if (stats) {
+				pixman_region32_t hit;
+				pixman_region32_init(&hit);
+				pixman_region32_intersect(&hit, &background, &opaque);
+				if (pixman_region32_not_empty(&hit)) {
+					stats->opaque_cull_hits++;
+				}
+				pixman_region32_fini(&hit);
+			}
+
 			pixman_region32_subtract(&background, &background, &opaque);
 			pixman_region32_fini(&opaque);
 		}
@@ -1849,6 +3009,10 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 			// outside of the damage region
 			pixman_region32_intersect(&background, &background, &render_data.damage);
 		}
+
+		if (stats) {
+			stats->culled_area = stats->damage_area - region_area(&background);
+		}
 	}
 
 	transform_output_damage(&background, &render_data);
@@ -1859,7 +3023,7 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 	});
 	pixman_region32_fini(&background);
 
-	for (int i = list_len - 1; i >= 0; i--) {
+	for (int i = list_len - 1; i >= offloaded; i--) {
 		struct render_list_entry *entry = &list_data[i];
 		scene_entry_render(entry, &render_data);
 
@@ -1924,12 +3088,43 @@ void wlr_scene_timer_finish(struct wlr_scene_timer *timer) {
 	}
 }
 
+static void scene_buffer_send_occluded_frame_done(
+		struct wlr_scene_buffer *scene_buffer, const struct wlr_box *output_box,
+		int lx, int ly, int interval, struct timespec *now) {
+	if (scene_buffer->buffer == NULL ||
+			pixman_region32_not_empty(&scene_buffer->node.visible)) {
+		return;
+	}
+
+	struct wlr_box node_box = { .x = lx, .y = ly };
+	scene_node_get_size(&scene_buffer->node, &node_box.width, &node_box.height);
+
+	struct wlr_box intersection;
+	if (!wlr_box_intersection(&intersection, output_box, &node_box)) {
+		return;
+	}
+
+	// The timestamp is shared between outputs, so that a buffer spanning
+	// multiple outputs is still throttled to the requested rate
+	int64_t now_msec = timespec_to_msec(now);
+	if (now_msec - scene_buffer->occluded_frame_done_msec < interval) {
+		return;
+	}
+
+	scene_buffer->occluded_frame_done_msec = now_msec;
+	wl_signal_emit_mutable(&scene_buffer->events.frame_done, now);
+}
+
 static void scene_node_send_frame_done(struct wlr_scene_node *node,
-		struct wlr_scene_output *scene_output, struct timespec *now) {
+		struct wlr_scene_output *scene_output, const struct wlr_box *output_box,
+		int lx, int ly, struct timespec *now) {
 	if (!node->enabled) {
 		return;
 	}
 
+	lx += node->x;
+	ly += node->y;
+
 	if (node->type == WLR_SCENE_NODE_BUFFER) {
 		struct wlr_scene_buffer *scene_buffer =
 			wlr_scene_buffer_from_node(node);
@@ -1937,19 +3132,29 @@ static void scene_node_send_frame_done(struct wlr_scene_node *node,
 		if (scene_buffer->primary_output == scene_output) {
 			wlr_scene_buffer_send_frame_done(scene_buffer, now);
 		}
+
+		int interval = scene_output->scene->occluded_frame_interval;
+		if (interval > 0) {
+			scene_buffer_send_occluded_frame_done(scene_buffer, output_box,
+				lx, ly, interval, now);
+		}
 	} else if (node->type == WLR_SCENE_NODE_TREE) {
 		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
 		struct wlr_scene_node *child;
 		wl_list_for_each(child, &scene_tree->children, link) {
-			scene_node_send_frame_done(child, scene_output, now);
+			scene_node_send_frame_done(child, scene_output, output_box,
+				lx, ly, now);
 		}
 	}
 }
 
 void wlr_scene_output_send_frame_done(struct wlr_scene_output *scene_output,
 		struct timespec *now) {
+	struct wlr_box box = { .x = scene_output->x, .y = scene_output->y };
+	wlr_output_effective_resolution(scene_output->output,
+		&box.width, &box.height);
 	scene_node_send_frame_done(&scene_output->scene->tree.node,
-		scene_output, now);
+		scene_output, &box, 0, 0, now);
 }
 
 static void scene_output_for_each_scene_buffer(const struct wlr_box *output_box,
@@ -1974,6 +3179,14 @@ static void scene_output_for_each_scene_buffer(const struct wlr_box *output_box,
 		}
 	} else if (node->type == WLR_SCENE_NODE_TREE) {
 		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
+
+		struct wlr_box bounds = *scene_tree_get_bounds(scene_tree);
+		bounds.x += lx;
+		bounds.y += ly;
+		if (!wlr_box_intersection(&bounds, &bounds, output_box)) {
+			return;
+		}
+
 		struct wlr_scene_node *child;
 		wl_list_for_each(child, &scene_tree->children, link) {
 			scene_output_for_each_scene_buffer(output_box, child, lx, ly,
@@ -1,29 +1,260 @@
 #include <limits.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pixman.h>
 #include <wlr/types/wlr_damage_ring.h>
 #include <wlr/util/box.h>
+#include "util/tile_bitmap.h"
 
 #define WLR_DAMAGE_RING_MAX_RECTS 20
 
+struct damage_cluster {
+	pixman_box32_t box;
+};
+
+static int64_t box_area(const pixman_box32_t *box) {
+	return (int64_t)(box->x2 - box->x1) * (box->y2 - box->y1);
+}
+
+static pixman_box32_t box_union(const pixman_box32_t *a,
+		const pixman_box32_t *b) {
+	return (pixman_box32_t){
+		.x1 = a->x1 < b->x1 ? a->x1 : b->x1,
+		.y1 = a->y1 < b->y1 ? a->y1 : b->y1,
+		.x2 = a->x2 > b->x2 ? a->x2 : b->x2,
+		.y2 = a->y2 > b->y2 ? a->y2 : b->y2,
+	};
+}
+
+static bool box_overlaps(const pixman_box32_t *a, const pixman_box32_t *b) {
+	return a->x1 < b->x2 && b->x1 < a->x2 && a->y1 < b->y2 && b->y1 < a->y2;
+}
+
+/**
+ * Change in cost when replacing two boxes with their bounding box: the extra
+ * area to redraw minus the cost of the rectangle saved.
+ */
+static int64_t merge_cost(const pixman_box32_t *a, const pixman_box32_t *b,
+		uint32_t rect_cost) {
+	pixman_box32_t merged = box_union(a, b);
+	return box_area(&merged) - box_area(a) - box_area(b) - rect_cost;
+}
+
+/**
+ * Reduce the number of rectangles in a damage region by greedily merging
+ * rectangles into clusters, as long as the extra area to redraw is cheaper
+ * than drawing separate rectangles. The number of rectangles is capped to
+ * WLR_DAMAGE_RING_MAX_RECTS.
+ */
+static void simplify_damage(pixman_region32_t *damage, uint32_t rect_cost) {
+	int n_rects;
+	const pixman_box32_t *rects = pixman_region32_rectangles(damage, &n_rects);
+	if (n_rects <= 1) {
+		return;
+	}
+
+	struct damage_cluster clusters[WLR_DAMAGE_RING_MAX_RECTS];
+	size_t clusters_len = 0;
+
+	for (int i = 0; i < n_rects; i++) {
+		const pixman_box32_t *rect = &rects[i];
+
+		size_t best = 0;
+		int64_t best_cost = INT64_MAX;
+		for (size_t j = 0; j < clusters_len; j++) {
+			int64_t cost = merge_cost(&clusters[j].box, rect, rect_cost);
+			if (cost < best_cost) {
+				best = j;
+				best_cost = cost;
+			}
+		}
+
+		if (best_cost > 0 && clusters_len < WLR_DAMAGE_RING_MAX_RECTS) {
+			clusters[clusters_len++].box = *rect;
+		} else {
+			clusters[best].box = box_union(&clusters[best].box, rect);
+		}
+	}
+
+	// Growing clusters may have made merging them worthwhile. Overlapping
+	// clusters are always merged, their union would be split again anyway.
+	while (clusters_len > 1) {
+		size_t best_a = 0, best_b = 0;
+		int64_t best_cost = INT64_MAX;
+		for (size_t a = 0; a < clusters_len; a++) {
+			for (size_t b = a + 1; b < clusters_len; b++) {
+				int64_t cost = box_overlaps(&clusters[a].box, &clusters[b].box) ?
+					INT64_MIN : merge_cost(&clusters[a].box, &clusters[b].box, rect_cost);
+				if (cost < best_cost) {
+					best_a = a;
+					best_b = b;
+					best_cost = cost;
+				}
+			}
+		}
+		if (best_cost > 0) {
+			break;
+		}
+
+		clusters[best_a].box = box_union(&clusters[best_a].box,
+			&clusters[best_b].box);
+		clusters[best_b] = clusters[--clusters_len];
+	}
+
+	if ((int)clusters_len == n_rects) {
+		return;
+	}
+
+	pixman_region32_clear(damage);
+	for (size_t i = 0; i < clusters_len; i++) {
+		const pixman_box32_t *box = &clusters[i].box;
+		pixman_region32_union_rect(damage, damage, box->x1, box->y1,
+			box->x2 - box->x1, box->y2 - box->y1);
+	}
+
+	// Non-overlapping clusters can still be split into bands by pixman
+	if (pixman_region32_n_rects(damage) > WLR_DAMAGE_RING_MAX_RECTS) {
+		pixman_box32_t extents = *pixman_region32_extents(damage);
+		pixman_region32_fini(damage);
+		pixman_region32_init_with_extents(damage, &extents);
+	}
+}
+
+/**
+ * Move the history from tile bitmaps back to regions.
+ */
+static void ring_disable_tiles(struct wlr_damage_ring *ring) {
+	if (ring->previous_tiles == NULL) {
+		return;
+	}
+
+	for (size_t i = 0; i < ring->previous_len; ++i) {
+		pixman_region32_clear(&ring->previous[i]);
+		tile_bitmap_union_region(&ring->previous_tiles[i], &ring->previous[i]);
+	}
+	for (size_t i = 0; i <= ring->previous_len; ++i) {
+		tile_bitmap_finish(&ring->previous_tiles[i]);
+	}
+	free(ring->previous_tiles);
+	ring->previous_tiles = NULL;
+}
+
+/**
+ * Move the history from regions to tile bitmaps, if enabled and possible.
+ */
+static void ring_enable_tiles(struct wlr_damage_ring *ring) {
+	if (ring->tile_size <= 0 || ring->width == INT_MAX ||
+			ring->previous_len == 0) {
+		return;
+	}
+
+	size_t len = ring->previous_len + 1;
+	struct tile_bitmap *tiles = calloc(len, sizeof(*tiles));
+	if (tiles == NULL) {
+		return;
+	}
+
+	for (size_t i = 0; i < len; ++i) {
+		if (!tile_bitmap_init(&tiles[i], ring->width, ring->height,
+				ring->tile_size)) {
+			for (size_t j = 0; j <= i; ++j) {
+				tile_bitmap_finish(&tiles[j]);
+			}
+			free(tiles);
+			return;
+		}
+	}
+
+	for (size_t i = 0; i < ring->previous_len; ++i) {
+		tile_bitmap_add_region(&tiles[i], &ring->previous[i]);
+		pixman_region32_clear(&ring->previous[i]);
+	}
+	ring->previous_tiles = tiles;
+}
+
 void wlr_damage_ring_init(struct wlr_damage_ring *ring) {
 	*ring = (struct wlr_damage_ring){
 		.width = INT_MAX,
 		.height = INT_MAX,
+		.rect_cost = WLR_DAMAGE_RING_DEFAULT_RECT_COST,
 	};
 
 	pixman_region32_init(&ring->current);
-	for (size_t i = 0; i < WLR_DAMAGE_RING_PREVIOUS_LEN; ++i) {
-		pixman_region32_init(&ring->previous[i]);
-	}
+
+	// On allocation failure, the ring has no history: buffers are always
+	// damaged fully
+	wlr_damage_ring_set_previous_len(ring, WLR_DAMAGE_RING_PREVIOUS_LEN);
 }
 
 void wlr_damage_ring_finish(struct wlr_damage_ring *ring) {
+	ring_disable_tiles(ring);
 	pixman_region32_fini(&ring->current);
-	for (size_t i = 0; i < WLR_DAMAGE_RING_PREVIOUS_LEN; ++i) {
+	for (size_t i = 0; i < ring->previous_len; ++i) {
 		pixman_region32_fini(&ring->previous[i]);
 	}
+	free(ring->previous);
+}
+
+bool wlr_damage_ring_set_previous_len(struct wlr_damage_ring *ring,
+		size_t len) {
+	if (len == ring->previous_len) {
+		return true;
+	}
+
+	pixman_region32_t *previous = NULL;
+	if (len > 0) {
+		previous = calloc(len, sizeof(*previous));
+		if (previous == NULL) {
+			return false;
+		}
+	}
+
+	ring_disable_tiles(ring);
+
+	// Move the most recent regions over, newest first. Damage for frames
+	// older than the previous history is unknown.
+	for (size_t i = 0; i < len; ++i) {
+		if (i < ring->previous_len) {
+			size_t j = (ring->previous_idx + i) % ring->previous_len;
+			pixman_region32_init(&previous[i]);
+			pixman_region32_copy(&previous[i], &ring->previous[j]);
+		} else {
+			pixman_region32_init_rect(&previous[i],
+				0, 0, ring->width, ring->height);
+		}
+	}
+
+	for (size_t i = 0; i < ring->previous_len; ++i) {
+		pixman_region32_fini(&ring->previous[i]);
+	}
+	free(ring->previous);
+
+	ring->previous = previous;
+	ring->previous_len = len;
+	ring->previous_idx = 0;
+
+	ring_enable_tiles(ring);
+	return true;
+}
+
+void wlr_damage_ring_set_tile_size(struct wlr_damage_ring *ring,
+		int tile_size) {
+	if (tile_size < 0) {
+		tile_size = 0;
+	}
+	if (ring->tile_size == tile_size) {
+		return;
+	}
+
+	ring_disable_tiles(ring);
+	ring->tile_size = tile_size;
+	ring_enable_tiles(ring);
+}
+
+void wlr_damage_ring_set_rect_cost(struct wlr_damage_ring *ring,
+		uint32_t cost) {
+	ring->rect_cost = cost;
 }
 
 void wlr_damage_ring_set_bounds(struct wlr_damage_ring *ring,
@@ -37,8 +268,11 @@ void wlr_damage_ring_set_bounds(struct wlr_damage_ring *ring,
 		return;
 	}
 
+	ring_disable_tiles(ring);
 	ring->width = width;
 	ring->height = height;
+	ring_enable_tiles(ring);
+
 	wlr_damage_ring_add_whole(ring);
 }
 
@@ -79,38 +313,58 @@ void wlr_damage_ring_add_whole(struct wlr_damage_ring *ring) {
 }
 
 void wlr_damage_ring_rotate(struct wlr_damage_ring *ring) {
+	if (ring->previous_len == 0) {
+		pixman_region32_clear(&ring->current);
+		return;
+	}
+
 	// modular decrement
-	ring->previous_idx = ring->previous_idx +
-		WLR_DAMAGE_RING_PREVIOUS_LEN - 1;
-	ring->previous_idx %= WLR_DAMAGE_RING_PREVIOUS_LEN;
+	ring->previous_idx = ring->previous_idx + ring->previous_len - 1;
+	ring->previous_idx %= ring->previous_len;
+
+	if (ring->previous_tiles != NULL) {
+		struct tile_bitmap *tiles = &ring->previous_tiles[ring->previous_idx];
+		tile_bitmap_clear(tiles);
+		tile_bitmap_add_region(tiles, &ring->current);
+		pixman_region32_clear(&ring->current);
+		return;
+	}
 
-	pixman_region32_copy(&ring->previous[ring->previous_idx], &ring->current);
+	// Swap instead of copying, the oldest region gets discarded anyway
+	pixman_region32_t tmp = ring->previous[ring->previous_idx];
+	ring->previous[ring->previous_idx] = ring->current;
+	ring->current = tmp;
 	pixman_region32_clear(&ring->current);
 }
 
 void wlr_damage_ring_get_buffer_damage(struct wlr_damage_ring *ring,
 		int buffer_age, pixman_region32_t *damage) {
-	if (buffer_age <= 0 || buffer_age - 1 > WLR_DAMAGE_RING_PREVIOUS_LEN) {
+	if (buffer_age <= 0 || (size_t)buffer_age - 1 > ring->previous_len) {
 		pixman_region32_clear(damage);
 		pixman_region32_union_rect(damage, damage,
 			0, 0, ring->width, ring->height);
+	} else if (ring->previous_tiles != NULL) {
+		pixman_region32_copy(damage, &ring->current);
+
+		// Accumulate damage from old buffers in the scratch bitmap
+		struct tile_bitmap *acc = &ring->previous_tiles[ring->previous_len];
+		tile_bitmap_clear(acc);
+		for (int i = 0; i < buffer_age - 1; ++i) {
+			size_t j = (ring->previous_idx + i) % ring->previous_len;
+			tile_bitmap_or(acc, &ring->previous_tiles[j]);
+		}
+		tile_bitmap_union_region(acc, damage);
+
+		simplify_damage(damage, ring->rect_cost);
 	} else {
 		pixman_region32_copy(damage, &ring->current);
 
 		// Accumulate damage from old buffers
 		for (int i = 0; i < buffer_age - 1; ++i) {
-			int j = (ring->previous_idx + i) % WLR_DAMAGE_RING_PREVIOUS_LEN;
+			size_t j = (ring->previous_idx + i) % ring->previous_len;
 			pixman_region32_union(damage, damage, &ring->previous[j]);
 		}
 
-		// Check the number of rectangles
-		int n_rects = pixman_region32_n_rects(damage);
-		if (n_rects > WLR_DAMAGE_RING_MAX_RECTS) {
-			pixman_box32_t *extents = pixman_region32_extents(damage);
-			pixman_region32_union_rect(damage, damage,
-				extents->x1, extents->y1,
-				extents->x2 - extents->x1,
-				extents->y2 - extents->y1);
-		}
+		simplify_damage(damage, ring->rect_cost);
 	}
 }
@@ -1,9 +1,42 @@
 #include <assert.h>
 #include <math.h>
 #include <limits.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <wlr/util/region.h>
 
+/* Regions with up to this many rectangles are transformed without a heap
+ * allocation. Damage usually has a handful of rectangles. */
+#define REGION_STACK_RECTS 32
+
+struct region_rects {
+	pixman_box32_t *data;
+	pixman_box32_t stack[REGION_STACK_RECTS];
+};
+
+static pixman_box32_t *region_rects_alloc(struct region_rects *rects, int n) {
+	if (n <= REGION_STACK_RECTS) {
+		rects->data = rects->stack;
+	} else {
+		rects->data = malloc(n * sizeof(pixman_box32_t));
+	}
+	return rects->data;
+}
+
+/**
+ * Replace the contents of dst with the rectangles, which may overlap. dst
+ * may be the region the rectangles were computed from.
+ */
+static void region_rects_finish(struct region_rects *rects,
+		pixman_region32_t *dst, int n) {
+	pixman_region32_fini(dst);
+	pixman_region32_init_rects(dst, rects->data, n);
+
+	if (rects->data != rects->stack) {
+		free(rects->data);
+	}
+}
+
 void wlr_region_scale(pixman_region32_t *dst, const pixman_region32_t *src,
 		float scale) {
 	wlr_region_scale_xy(dst, src, scale, scale);
@@ -19,7 +52,8 @@ void wlr_region_scale_xy(pixman_region32_t *dst, const pixman_region32_t *src,
 	int nrects;
 	const pixman_box32_t *src_rects = pixman_region32_rectangles(src, &nrects);
 
-	pixman_box32_t *dst_rects = malloc(nrects * sizeof(pixman_box32_t));
+	struct region_rects rects;
+	pixman_box32_t *dst_rects = region_rects_alloc(&rects, nrects);
 	if (dst_rects == NULL) {
 		return;
 	}
@@ -31,9 +65,7 @@ void wlr_region_scale_xy(pixman_region32_t *dst, const pixman_region32_t *src,
 		dst_rects[i].y2 = ceil(src_rects[i].y2 * scale_y);
 	}
 
-	pixman_region32_fini(dst);
-	pixman_region32_init_rects(dst, dst_rects, nrects);
-	free(dst_rects);
+	region_rects_finish(&rects, dst, nrects);
 }
 
 void wlr_region_transform(pixman_region32_t *dst, const pixman_region32_t *src,
@@ -46,67 +78,70 @@ void wlr_region_transform(pixman_region32_t *dst, const pixman_region32_t *src,
 	int nrects;
 	const pixman_box32_t *src_rects = pixman_region32_rectangles(src, &nrects);
 
-	pixman_box32_t *dst_rects = malloc(nrects * sizeof(pixman_box32_t));
+	struct region_rects rects;
+	pixman_box32_t *dst_rects = region_rects_alloc(&rects, nrects);
 	if (dst_rects == NULL) {
 		return;
 	}
 
-	for (int i = 0; i < nrects; ++i) {
-		switch (transform) {
-		case WL_OUTPUT_TRANSFORM_NORMAL:
-			dst_rects[i].x1 = src_rects[i].x1;
-			dst_rects[i].y1 = src_rects[i].y1;
-			dst_rects[i].x2 = src_rects[i].x2;
-			dst_rects[i].y2 = src_rects[i].y2;
-			break;
-		case WL_OUTPUT_TRANSFORM_90:
-			dst_rects[i].x1 = height - src_rects[i].y2;
-			dst_rects[i].y1 = src_rects[i].x1;
-			dst_rects[i].x2 = height - src_rects[i].y1;
-			dst_rects[i].y2 = src_rects[i].x2;
-			break;
-		case WL_OUTPUT_TRANSFORM_180:
-			dst_rects[i].x1 = width - src_rects[i].x2;
-			dst_rects[i].y1 = height - src_rects[i].y2;
-			dst_rects[i].x2 = width - src_rects[i].x1;
-			dst_rects[i].y2 = height - src_rects[i].y1;
-			break;
-		case WL_OUTPUT_TRANSFORM_270:
-			dst_rects[i].x1 = src_rects[i].y1;
-			dst_rects[i].y1 = width - src_rects[i].x2;
-			dst_rects[i].x2 = src_rects[i].y2;
-			dst_rects[i].y2 = width - src_rects[i].x1;
-			break;
-		case WL_OUTPUT_TRANSFORM_FLIPPED:
-			dst_rects[i].x1 = width - src_rects[i].x2;
-			dst_rects[i].y1 = src_rects[i].y1;
-			dst_rects[i].x2 = width - src_rects[i].x1;
-			dst_rects[i].y2 = src_rects[i].y2;
-			break;
-		case WL_OUTPUT_TRANSFORM_FLIPPED_90:
+	// Every transform is an optional swap of the axes followed by optional
+	// flips. Deciding that once keeps the loops free of branches, so that
+	// they can be vectorized.
+	bool swap = transform & WL_OUTPUT_TRANSFORM_90;
+	int out_width = swap ? height : width;
+	int out_height = swap ? width : height;
+	bool flip_x, flip_y;
+	switch (transform) {
+	case WL_OUTPUT_TRANSFORM_90:
+	case WL_OUTPUT_TRANSFORM_FLIPPED:
+		flip_x = true;
+		flip_y = false;
+		break;
+	case WL_OUTPUT_TRANSFORM_180:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
+		flip_x = true;
+		flip_y = true;
+		break;
+	case WL_OUTPUT_TRANSFORM_270:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
+		flip_x = false;
+		flip_y = true;
+		break;
+	default:
+		flip_x = false;
+		flip_y = false;
+		break;
+	}
+
+	if (swap) {
+		for (int i = 0; i < nrects; ++i) {
 			dst_rects[i].x1 = src_rects[i].y1;
 			dst_rects[i].y1 = src_rects[i].x1;
 			dst_rects[i].x2 = src_rects[i].y2;
 			dst_rects[i].y2 = src_rects[i].x2;
-			break;
-		case WL_OUTPUT_TRANSFORM_FLIPPED_180:
-			dst_rects[i].x1 = src_rects[i].x1;
-			dst_rects[i].y1 = height - src_rects[i].y2;
-			dst_rects[i].x2 = src_rects[i].x2;
-			dst_rects[i].y2 = height - src_rects[i].y1;
-			break;
-		case WL_OUTPUT_TRANSFORM_FLIPPED_270:
-			dst_rects[i].x1 = height - src_rects[i].y2;
-			dst_rects[i].y1 = width - src_rects[i].x2;
-			dst_rects[i].x2 = height - src_rects[i].y1;
-			dst_rects[i].y2 = width - src_rects[i].x1;
-			break;
+		}
+	} else {
+		for (int i = 0; i < nrects; ++i) {
+			dst_rects[i] = src_rects[i];
 		}
 	}
 
-	pixman_region32_fini(dst);
-	pixman_region32_init_rects(dst, dst_rects, nrects);
-	free(dst_rects);
+	if (flip_x) {
+		for (int i = 0; i < nrects; ++i) {
+			int x1 = dst_rects[i].x1;
+			dst_rects[i].x1 = out_width - dst_rects[i].x2;
+			dst_rects[i].x2 = out_width - x1;
+		}
+	}
+	if (flip_y) {
+		for (int i = 0; i < nrects; ++i) {
+			int y1 = dst_rects[i].y1;
+			dst_rects[i].y1 = out_height - dst_rects[i].y2;
+			dst_rects[i].y2 = out_height - y1;
+		}
+	}
+
+	region_rects_finish(&rects, dst, nrects);
 }
 
 void wlr_region_expand(pixman_region32_t *dst, const pixman_region32_t *src,
@@ -121,7 +156,8 @@ void wlr_region_expand(pixman_region32_t *dst, const pixman_region32_t *src,
 	int nrects;
 	const pixman_box32_t *src_rects = pixman_region32_rectangles(src, &nrects);
 
-	pixman_box32_t *dst_rects = malloc(nrects * sizeof(pixman_box32_t));
+	struct region_rects rects;
+	pixman_box32_t *dst_rects = region_rects_alloc(&rects, nrects);
 	if (dst_rects == NULL) {
 		return;
 	}
@@ -133,9 +169,7 @@ void wlr_region_expand(pixman_region32_t *dst, const pixman_region32_t *src,
 		dst_rects[i].y2 = src_rects[i].y2 + distance;
 	}
 
-	pixman_region32_fini(dst);
-	pixman_region32_init_rects(dst, dst_rects, nrects);
-	free(dst_rects);
+	region_rects_finish(&rects, dst, nrects);
 }
 
 void wlr_region_rotated_bounds(pixman_region32_t *dst, const pixman_region32_t *src,
@@ -0,0 +1,247 @@
+#include <stdlib.h>
+#include <string.h>
+#include <wayland-util.h>
+#include "util/tile_bitmap.h"
+
+bool tile_bitmap_init(struct tile_bitmap *tb, int width, int height,
+		int tile_size) {
+	int cols = (width + tile_size - 1) / tile_size;
+	int rows = (height + tile_size - 1) / tile_size;
+	size_t stride = ((size_t)cols + 63) / 64;
+
+	*tb = (struct tile_bitmap){
+		.width = width,
+		.height = height,
+		.tile_size = tile_size,
+		.cols = cols,
+		.rows = rows,
+		.stride = stride,
+	};
+
+	if (stride * rows == 0) {
+		return true;
+	}
+
+	tb->bits = calloc(stride * rows, sizeof(tb->bits[0]));
+	return tb->bits != NULL;
+}
+
+void tile_bitmap_finish(struct tile_bitmap *tb) {
+	free(tb->bits);
+	tb->bits = NULL;
+}
+
+void tile_bitmap_clear(struct tile_bitmap *tb) {
+	if (tb->bits != NULL) {
+		memset(tb->bits, 0, tb->stride * tb->rows * sizeof(tb->bits[0]));
+	}
+}
+
+// Masks of the columns c1 to c2 in their first and last words
+static uint64_t first_word_mask(int c1) {
+	return ~(uint64_t)0 << (c1 % 64);
+}
+
+static uint64_t last_word_mask(int c2) {
+	return ~(uint64_t)0 >> (63 - c2 % 64);
+}
+
+/**
+ * Convert a box to an inclusive range of tiles. Returns false if the box
+ * doesn't intersect the bitmap.
+ */
+static bool box_to_tiles(const struct tile_bitmap *tb, const pixman_box32_t *box,
+		int *c1, int *r1, int *c2, int *r2) {
+	int x1 = box->x1 > 0 ? box->x1 : 0;
+	int y1 = box->y1 > 0 ? box->y1 : 0;
+	int x2 = box->x2 < tb->width ? box->x2 : tb->width;
+	int y2 = box->y2 < tb->height ? box->y2 : tb->height;
+	if (x1 >= x2 || y1 >= y2) {
+		return false;
+	}
+
+	*c1 = x1 / tb->tile_size;
+	*r1 = y1 / tb->tile_size;
+	*c2 = (x2 - 1) / tb->tile_size;
+	*r2 = (y2 - 1) / tb->tile_size;
+	return true;
+}
+
+static void set_tiles(struct tile_bitmap *tb, int c1, int r1, int c2, int r2) {
+	size_t w1 = c1 / 64, w2 = c2 / 64;
+	uint64_t first = first_word_mask(c1);
+	uint64_t last = last_word_mask(c2);
+
+	for (int r = r1; r <= r2; r++) {
+		uint64_t *row = &tb->bits[r * tb->stride];
+		if (w1 == w2) {
+			row[w1] |= first & last;
+			continue;
+		}
+
+		row[w1] |= first;
+		for (size_t w = w1 + 1; w < w2; w++) {
+			row[w] = ~(uint64_t)0;
+		}
+		row[w2] |= last;
+	}
+}
+
+void tile_bitmap_fill(struct tile_bitmap *tb) {
+	if (tb->cols > 0 && tb->rows > 0) {
+		set_tiles(tb, 0, 0, tb->cols - 1, tb->rows - 1);
+	}
+}
+
+void tile_bitmap_add_box(struct tile_bitmap *tb, const pixman_box32_t *box) {
+	int c1, r1, c2, r2;
+	if (box_to_tiles(tb, box, &c1, &r1, &c2, &r2)) {
+		set_tiles(tb, c1, r1, c2, r2);
+	}
+}
+
+void tile_bitmap_add_region(struct tile_bitmap *tb,
+		const pixman_region32_t *region) {
+	int n_rects;
+	const pixman_box32_t *rects =
+		pixman_region32_rectangles(region, &n_rects);
+	for (int i = 0; i < n_rects; i++) {
+		tile_bitmap_add_box(tb, &rects[i]);
+	}
+}
+
+void tile_bitmap_or(struct tile_bitmap *dst, const struct tile_bitmap *src) {
+	size_t len = dst->stride * dst->rows;
+	// Simple enough for compilers to vectorize
+	for (size_t i = 0; i < len; i++) {
+		dst->bits[i] |= src->bits[i];
+	}
+}
+
+bool tile_bitmap_intersects_box(const struct tile_bitmap *tb,
+		const pixman_box32_t *box) {
+	int c1, r1, c2, r2;
+	if (!box_to_tiles(tb, box, &c1, &r1, &c2, &r2)) {
+		return false;
+	}
+
+	size_t w1 = c1 / 64, w2 = c2 / 64;
+	uint64_t first = first_word_mask(c1);
+	uint64_t last = last_word_mask(c2);
+	for (int r = r1; r <= r2; r++) {
+		const uint64_t *row = &tb->bits[r * tb->stride];
+		if (w1 == w2) {
+			if (row[w1] & first & last) {
+				return true;
+			}
+			continue;
+		}
+
+		uint64_t any = (row[w1] & first) | (row[w2] & last);
+		for (size_t w = w1 + 1; w < w2; w++) {
+			any |= row[w];
+		}
+		if (any != 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool tile_is_set(const uint64_t *row, int col) {
+	return row[col / 64] & ((uint64_t)1 << (col % 64));
+}
+
+void tile_bitmap_union_region(const struct tile_bitmap *tb,
+		pixman_region32_t *region) {
+	// Runs of damaged tiles are extended downwards for as long as the next
+	// row has the exact same run
+	struct wl_array boxes; // pixman_box32_t
+	struct wl_array open, next_open; // size_t, indices of boxes ending on the
+	                                 // previous/current row, sorted by x1
+	wl_array_init(&boxes);
+	wl_array_init(&open);
+	wl_array_init(&next_open);
+
+	for (int r = 0; r < tb->rows; r++) {
+		const uint64_t *row = &tb->bits[r * tb->stride];
+		size_t *open_data = open.data;
+		size_t open_len = open.size / sizeof(size_t);
+		size_t open_idx = 0;
+		next_open.size = 0;
+
+		int c = 0;
+		while (c < tb->cols) {
+			if (row[c / 64] == 0) {
+				c = (c / 64 + 1) * 64;
+				continue;
+			}
+			if (!tile_is_set(row, c)) {
+				c++;
+				continue;
+			}
+
+			int start = c;
+			while (c < tb->cols && tile_is_set(row, c)) {
+				c++;
+			}
+
+			int x1 = start * tb->tile_size;
+			int x2 = c * tb->tile_size;
+			x2 = x2 < tb->width ? x2 : tb->width;
+			int y2 = (r + 1) * tb->tile_size;
+			y2 = y2 < tb->height ? y2 : tb->height;
+
+			pixman_box32_t *all = boxes.data;
+			while (open_idx < open_len && all[open_data[open_idx]].x1 < x1) {
+				open_idx++;
+			}
+
+			size_t index;
+			if (open_idx < open_len && all[open_data[open_idx]].x1 == x1 &&
+					all[open_data[open_idx]].x2 == x2) {
+				index = open_data[open_idx];
+				all[index].y2 = y2;
+			} else {
+				pixman_box32_t *box = wl_array_add(&boxes, sizeof(*box));
+				if (box == NULL) {
+					goto err_alloc;
+				}
+				*box = (pixman_box32_t){
+					.x1 = x1,
+					.y1 = r * tb->tile_size,
+					.x2 = x2,
+					.y2 = y2,
+				};
+				index = boxes.size / sizeof(*box) - 1;
+			}
+
+			size_t *next = wl_array_add(&next_open, sizeof(*next));
+			if (next != NULL) {
+				*next = index;
+			}
+		}
+
+		struct wl_array tmp = open;
+		open = next_open;
+		next_open = tmp;
+	}
+
+	pixman_region32_t tiles;
+	pixman_region32_init_rects(&tiles, boxes.data,
+		boxes.size / sizeof(pixman_box32_t));
+	pixman_region32_union(region, region, &tiles);
+	pixman_region32_fini(&tiles);
+
+	wl_array_release(&next_open);
+	wl_array_release(&open);
+	wl_array_release(&boxes);
+	return;
+
+err_alloc:
+	wl_array_release(&next_open);
+	wl_array_release(&open);
+	wl_array_release(&boxes);
+	// Damage must not be lost, fall back to the whole bitmap
+	pixman_region32_union_rect(region, region, 0, 0, tb->width, tb->height);
+}
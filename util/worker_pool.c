@@ -0,0 +1,163 @@
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <wlr/util/log.h>
+#include "util/worker_pool.h"
+
+struct worker_pool {
+	pthread_t *threads;
+	size_t threads_len;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+
+	// Current job, protected by the mutex
+	uint64_t generation;
+	worker_pool_func_t func;
+	void *data;
+	size_t len;
+	size_t active; // workers which haven't finished the current job yet
+	bool stop;
+
+	atomic_size_t next; // next index to process
+};
+
+static void pool_process(struct worker_pool *pool, size_t len,
+		worker_pool_func_t func, void *data) {
+	size_t i;
+	while ((i = atomic_fetch_add(&pool->next, 1)) < len) {
+		func(data, i);
+	}
+}
+
+static void *worker_run(void *data) {
+	struct worker_pool *pool = data;
+	uint64_t generation = 0;
+
+	pthread_mutex_lock(&pool->mutex);
+	while (true) {
+		while (!pool->stop && pool->generation == generation) {
+			pthread_cond_wait(&pool->work_cond, &pool->mutex);
+		}
+		if (pool->stop) {
+			break;
+		}
+
+		generation = pool->generation;
+		worker_pool_func_t func = pool->func;
+		void *func_data = pool->data;
+		size_t len = pool->len;
+		pthread_mutex_unlock(&pool->mutex);
+
+		pool_process(pool, len, func, func_data);
+
+		pthread_mutex_lock(&pool->mutex);
+		pool->active--;
+		if (pool->active == 0) {
+			pthread_cond_signal(&pool->done_cond);
+		}
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+struct worker_pool *worker_pool_create(size_t threads) {
+	struct worker_pool *pool = calloc(1, sizeof(*pool));
+	if (pool == NULL) {
+		return NULL;
+	}
+
+	pool->threads = calloc(threads, sizeof(pool->threads[0]));
+	if (threads > 0 && pool->threads == NULL) {
+		free(pool);
+		return NULL;
+	}
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+	atomic_init(&pool->next, 0);
+
+	// Threads inherit the signal mask of their creator. Signals raised by
+	// faults are delivered to the faulting thread, and blocking them kills
+	// the process instead: e.g. the wl_shm SIGBUS handler must still run
+	// when a client truncates its pool while a worker reads from it.
+	sigset_t all, prev;
+	sigfillset(&all);
+	sigdelset(&all, SIGBUS);
+	sigdelset(&all, SIGSEGV);
+	sigdelset(&all, SIGFPE);
+	sigdelset(&all, SIGILL);
+	pthread_sigmask(SIG_SETMASK, &all, &prev);
+
+	for (size_t i = 0; i < threads; i++) {
+		if (pthread_create(&pool->threads[i], NULL, worker_run, pool) != 0) {
+			wlr_log(WLR_ERROR, "Failed to create worker thread");
+			break;
+		}
+		pool->threads_len++;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &prev, NULL);
+
+	if (pool->threads_len != threads) {
+		worker_pool_destroy(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+void worker_pool_destroy(struct worker_pool *pool) {
+	if (pool == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (size_t i = 0; i < pool->threads_len; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->threads);
+	free(pool);
+}
+
+void worker_pool_run(struct worker_pool *pool, size_t len,
+		worker_pool_func_t func, void *data) {
+	if (pool == NULL || pool->threads_len == 0 || len <= 1) {
+		for (size_t i = 0; i < len; i++) {
+			func(data, i);
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->func = func;
+	pool->data = data;
+	pool->len = len;
+	pool->active = pool->threads_len;
+	atomic_store(&pool->next, 0);
+	pool->generation++;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	pool_process(pool, len, func, data);
+
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->active > 0) {
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+}